@@ -26,6 +26,7 @@ http://www.gnu.org
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <sys/time.h>
 #include "compat.h"
 
 void _splitpath(
@@ -142,3 +143,11 @@ char* strlwr(char* s)
 	while (*p != '\000') *p = tolower(*p), ++p;
 	return s;
 }
+
+double WallTime(void) /* seconds since the epoch */
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -41,4 +41,5 @@ int getch(void);
 int memcmpi(const void*, const void*, size_t);
 char* strupr(char*);
 char* strlwr(char*);
+double WallTime(void);
 #endif
@@ -24,6 +24,10 @@ http://www.gnu.org
 /* HELPDEC1.C - HELPDECO supporting functions */
 #include "helpdeco.h"
 
+#ifdef HELPDECO_LIBRARY
+jmp_buf* QuitJump;
+#endif
+
 void error(const char* format, ...)
 {
 	va_list arg;
@@ -32,8 +36,12 @@ void error(const char* format, ...)
 	va_start(arg, format);
 	vfprintf(stderr, format, arg);
 	va_end(arg);
+#ifdef HELPDECO_LIBRARY
+	fputs("\n", stderr); /* no one to ask, continue at own risk */
+#else
 	fputs("\nPress CR to continue at your own risk, any other key to exit.\n", stderr);
 	if (getch() != '\r') exit(1);
+#endif
 }
 
 #ifndef HAVE_STRNCPY
@@ -52,6 +60,28 @@ size_t strlcpy(char* dest, const char* src, size_t len) /* limited string copy *
 #endif /* !defined(HAVE_STRLCPY) */
 #endif /* !defined(HAVE_STRNCPY) */
 
+/* give up: end the program with status, or in the library return to the
+// HelpDeco function called, which then fails */
+void quit(int status)
+{
+#ifdef HELPDECO_LIBRARY
+	longjmp(*QuitJump, 1);
+#else
+	exit(status);
+#endif
+}
+
+void progress(const char* format, ...)
+{
+#ifndef HELPDECO_LIBRARY
+	va_list arg;
+
+	va_start(arg, format);
+	vfprintf(stderr, format, arg);
+	va_end(arg);
+#endif
+}
+
 void* my_malloc(long bytes) /* save malloc function */
 {
 	void* ptr;
@@ -59,7 +89,12 @@ void* my_malloc(long bytes) /* save malloc function */
 	if (bytes < 1L || ((size_t)bytes != bytes) || (ptr = malloc((size_t)bytes)) == NULL)
 	{
 		fprintf(stderr, "Allocation of %ld bytes failed. File too big.\n", bytes);
-		exit(1);
+		quit(1);
+	}
+	if (stats)
+	{
+		Stats.Mallocs++;
+		Stats.MallocBytes += bytes;
 	}
 	return ptr;
 }
@@ -70,7 +105,12 @@ void* my_realloc(void* ptr, long bytes) /* save realloc function */
 	if (bytes < 1L || bytes != (size_t)bytes || (ptr = realloc(ptr, (size_t)bytes)) == NULL)
 	{
 		fprintf(stderr, "Reallocation to %ld bytes failed. File too big.\n", bytes);
-		exit(1);
+		quit(1);
+	}
+	if (stats)
+	{
+		Stats.Mallocs++;
+		Stats.MallocBytes += bytes;
 	}
 	return ptr;
 }
@@ -87,6 +127,78 @@ char* my_strdup(const char* ptr) /* save strdup function */
 	return dup;
 }
 
+/* ArenaAlloc hands out memory from a block owned by the arena that is only
+// released as a whole by ArenaReset. Requests that don't fit are served from
+// separate chunks of at least ARENACHUNKSIZE bytes, whose rest serves the
+// following small requests, and the next ArenaReset enlarges the block to
+// cover them, so a loop resetting the arena per record soon stops calling
+// malloc at all and an arena never reset calls it once per chunk */
+#define ARENACHUNKSIZE 0x4000L
+void* ArenaAlloc(ARENA* a, long bytes)
+{
+	ARENACHUNK* chunk;
+	void* ptr;
+	long size;
+
+	bytes = (bytes + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+	if (bytes < (long)sizeof(double)) bytes = sizeof(double);
+	if (a->used + bytes <= a->size)
+	{
+		ptr = a->base + a->used;
+		a->used += bytes;
+		return ptr;
+	}
+	a->overflow += bytes;
+	if (bytes <= a->spareleft)
+	{
+		ptr = a->spare;
+		a->spare += bytes;
+		a->spareleft -= bytes;
+		return ptr;
+	}
+	size = bytes < ARENACHUNKSIZE ? ARENACHUNKSIZE : bytes;
+	chunk = my_malloc(sizeof(ARENACHUNK) - sizeof(double) + size);
+	chunk->next = a->chunks;
+	a->chunks = chunk;
+	a->spare = (char*)&chunk->align + bytes;
+	a->spareleft = size - bytes;
+	return &chunk->align;
+}
+
+void ArenaReset(ARENA* a)
+{
+	ARENACHUNK* chunk;
+	long size;
+
+	while ((chunk = a->chunks) != NULL)
+	{
+		a->chunks = chunk->next;
+		free(chunk);
+	}
+	a->spare = NULL;
+	a->spareleft = 0L;
+	a->used = 0L;
+	if (a->overflow)
+	{
+		size = a->size + a->overflow;
+		if (a->base) free(a->base);
+		a->base = NULL; /* empty arena if my_malloc fails */
+		a->size = 0L;
+		a->overflow = 0L;
+		a->base = my_malloc(size);
+		a->size = size;
+	}
+}
+
+void ArenaFree(ARENA* a)
+{
+	a->overflow = 0L;
+	ArenaReset(a);
+	if (a->base) free(a->base);
+	a->base = NULL;
+	a->size = 0L;
+}
+
 size_t my_fread(void* ptr, long bytes, FILE* f) /* save fread function */
 {
 	size_t result;
@@ -96,6 +208,7 @@ size_t my_fread(void* ptr, long bytes, FILE* f) /* save fread function */
 	{
 		error("my_fread(%ld) at %ld failed", bytes, ftell(f));
 	}
+	if (stats) Stats.BytesRead += bytes;
 	return result;
 }
 
@@ -110,11 +223,12 @@ size_t my_gets(char* ptr, size_t size, FILE* f)  /* read nul terminated string f
 		if (i >= size - 1)
 		{
 			fputs("String length exceeds decompiler limit.\n", stderr);
-			exit(1);
+			quit(1);
 		}
 		ptr[i++] = c;
 	}
 	ptr[i] = '\0';
+	if (stats) Stats.BytesRead += i + 1;
 	return i;
 }
 
@@ -123,16 +237,20 @@ void my_fclose(FILE* f) /* checks if disk is full */
 	if (ferror(f) != 0)
 	{
 		fputs("File write error. Program aborted.\n", stderr);
-		exit(2);
+		quit(2);
 	}
+	if (stats) Stats.Written += ftell(f);
 	fclose(f);
 }
 
 FILE* my_fopen(const char* filename, const char* mode) /* save fopen function */
 {
 	FILE* f;
+#ifndef HELPDECO_LIBRARY
 	char ch;
+#endif
 
+#ifndef HELPDECO_LIBRARY /* never ask, library callers choose to overwrite */
 	if (!overwriteFile)
 	{
 		f = fopen(filename, "rb");
@@ -151,6 +269,7 @@ FILE* my_fopen(const char* filename, const char* mode) /* save fopen function */
 			if (ch == 'N') return NULL;
 		}
 	}
+#endif
 	f = fopen(filename, mode);
 	if (!f)
 	{
@@ -168,6 +287,7 @@ uint16_t my_getw(FILE* f) /* get 16 bit quantity */
 	int ch;
 
 	ch = getc(f);
+	if (stats) Stats.BytesRead += 2;
 	return ch | (getc(f) << 8);
 }
 
@@ -240,6 +360,7 @@ int MemoryGet(MFILE* f) /* get char from memory mapped file */
 
 int FileGet(MFILE* f) /* get char from regular file */
 {
+	if (stats) Stats.BytesRead++;
 	return getc(f->f);
 }
 
@@ -262,7 +383,7 @@ size_t FileRead(MFILE* f, void* ptr, long bytes) /* read function for regular fi
 
 long MemoryTell(MFILE* f) /* tell for memory mapped file */
 {
-	return (long)f->ptr;
+	return (long)(f->ptr - f->start);
 }
 
 long FileTell(MFILE* f) /* tell for regular file */
@@ -272,7 +393,7 @@ long FileTell(MFILE* f) /* tell for regular file */
 
 void MemorySeek(MFILE* f, long offset) /* seek in memory mapped file */
 {
-	f->ptr = (char*)offset;
+	f->ptr = f->start + offset;
 }
 
 void FileSeek(MFILE* f, long offset) /* seek in regular file */
@@ -286,7 +407,7 @@ MFILE* CreateMap(char* ptr, size_t size) /* assign a memory mapped file */
 
 	f = my_malloc(sizeof(MFILE));
 	f->f = NULL;
-	f->ptr = ptr;
+	f->start = f->ptr = ptr;
 	f->end = ptr + size;
 	f->get = MemoryGet;
 	f->put = MemoryPut;
@@ -302,7 +423,7 @@ MFILE* CreateVirtual(FILE* f)  /* assign a real file */
 
 	mf = my_malloc(sizeof(MFILE));
 	mf->f = f;
-	mf->ptr = mf->end = NULL;
+	mf->start = mf->ptr = mf->end = NULL;
 	mf->get = FileGet;
 	mf->put = FilePut;
 	mf->read = FileRead;
@@ -361,7 +482,7 @@ size_t StringRead(char* ptr, size_t size, MFILE* f) /* read nul terminated strin
 		if (i >= size - 1)
 		{
 			fputs("String length exceeds decompiler limit.\n", stderr);
-			exit(1);
+			quit(1);
 		}
 		ptr[i++] = c;
 	}
@@ -441,6 +562,7 @@ long decompress(int method, MFILE* f, long bytes, MFILE* fTarget)
 	long n;
 
 	n = 0;
+	if (stats) Stats.Blocks++;
 	if (method & 1)
 	{
 		Emit = DeRun;
@@ -486,6 +608,7 @@ long decompress(int method, MFILE* f, long bytes, MFILE* fTarget)
 	{
 		while (bytes-- > 0L) n += Emit(fTarget, f->get(f));
 	}
+	if (stats) Stats.Decompressed += n;
 	return n;
 }
 
@@ -512,41 +635,87 @@ long DecompressIntoFile(int method, MFILE* f, long bytes, FILE* fTarget)
 	return bytes;
 }
 
+/* hex dump lines are formatted into hexout and written in large blocks.
+// HexDumpLine produces exactly what printf("%08lX ") and printf("%02X ")
+// for each byte, a tab and blank for each missing byte, and the text part
+// used to write, that's at most 8+1+16*3+16+1 characters */
+#define HEXLINE 80
+#define HEXLINES 64
+#define HEXCHUNK (sizeof(int) > 2 ? 0x10000L : 0x4000L) /* bytes HexDump reads at once, multiple of 16 */
+static char hexout[HEXLINE * HEXLINES];
+static const char hexdigit[] = "0123456789ABCDEF";
+
+static char* HexDumpLine(char* p, unsigned long addr, const unsigned char* b, int n)
+{
+	int i;
+
+	if (addr > 0xFFFFFFFFUL)
+	{
+		p += sprintf(p, "%08lX", addr);
+	}
+	else
+	{
+		for (i = 28; i >= 0; i -= 4) *p++ = hexdigit[(addr >> i) & 0x0F];
+	}
+	*p++ = ' ';
+	for (i = 0; i < n; i++)
+	{
+		*p++ = hexdigit[b[i] >> 4];
+		*p++ = hexdigit[b[i] & 0x0F];
+		*p++ = ' ';
+	}
+	for (; i < 16; i++)
+	{
+		*p++ = '\t';
+		*p++ = ' ';
+	}
+	for (i = 0; i < n; i++) *p++ = isprint(b[i]) ? b[i] : '.';
+	*p++ = '\n';
+	return p;
+}
+
+/* hex dump FileLength bytes of mem numbered from addr, flushing hexout */
+static void HexDumpBlock(const unsigned char* mem, unsigned long addr, unsigned long FileLength)
+{
+	char* p;
+	unsigned long l;
+
+	p = hexout;
+	for (l = 0; l < FileLength; l += 16)
+	{
+		if (p > hexout + sizeof(hexout) - HEXLINE)
+		{
+			fwrite(hexout, p - hexout, 1, stdout);
+			p = hexout;
+		}
+		p = HexDumpLine(p, addr + l, mem + l, (int)(FileLength - l > 16 ? 16 : FileLength - l));
+	}
+	if (p > hexout) fwrite(hexout, p - hexout, 1, stdout);
+}
+
 void HexDump(FILE* f, long FileLength, long offset)
 {
-	unsigned char b[16];
-	long l;
-	int n, i;
+	unsigned char* chunk;
+	long l, n;
+	size_t got;
 
 	puts("[-Addr-] [--------------------Data---------------------] [-----Text-----]");
 	fseek(f, offset, SEEK_CUR);
-	for (l = offset; l < FileLength; l += 16)
+	chunk = my_malloc(HEXCHUNK);
+	for (l = offset; l < FileLength; l += n)
 	{
-		printf("%08lX ", l);
-		n = (int)(FileLength - l > 16 ? 16 : FileLength - l);
-		for (i = 0; i < n; i++) printf("%02X ", b[i] = getc(f));
-		while (i++ < 16) printf("	 ");
-		for (i = 0; i < n; i++) putchar(isprint(b[i]) ? b[i] : '.');
-		putchar('\n');
+		n = FileLength - l > HEXCHUNK ? HEXCHUNK : FileLength - l;
+		got = fread(chunk, 1, (size_t)n, f);
+		if (got < (size_t)n) memset(chunk + got, 0xFF, (size_t)n - got); /* EOF as getc returned it */
+		HexDumpBlock(chunk, l, n);
 	}
+	free(chunk);
 }
 
 void HexDumpMemory(unsigned char* bypMem, unsigned int FileLength)
 {
-	unsigned char b[16];
-	unsigned int l;
-	int n, i;
-
 	puts("[-Addr-] [--------------------Data---------------------] [-----Text-----]");
-	for (l = 0; l < FileLength; l += 16)
-	{
-		printf("%08X ", l);
-		n = (int)(FileLength - l > 16 ? 16 : FileLength - l);
-		for (i = 0; i < n; i++) printf("%02X ", b[i] = *bypMem++);
-		while (i++ < 16) printf("	 ");
-		for (i = 0; i < n; i++) putchar(isprint(b[i]) ? b[i] : '.');
-		putchar('\n');
-	}
+	HexDumpBlock(bypMem, 0L, FileLength);
 }
 
 /* write str to stdout, replacing nonprintable characters with hex codes,
@@ -568,28 +737,6 @@ char* PrintString(const char* str, unsigned int len)
 	return (char*)str;
 }
 
-/* get next bit (lsb first) from 32 bit words in f, initialized if f = NULL */
-/* important to read longs to stop at right position */
-BOOL GetBit(FILE* f)
-{
-	static uint32_t mask;
-	static uint32_t value;
-
-	if (f)
-	{
-		mask <<= 1;
-		if (!mask)
-		{
-			value = getdw(f);
-			mask = 1L;
-		}
-	}
-	else
-	{
-		mask = 0L; /* initialize */
-	}
-	return (value & mask) != 0L;
-}
 /* output str to RTF file, escaping necessary characters */
 void putrtf(FILE* rtf, const char* str)
 {
@@ -611,6 +758,60 @@ void putrtf(FILE* rtf, const char* str)
 	}
 }
 
+/* Unicode of Windows-1252 characters 0x80 to 0x9F, 0 if unassigned */
+static const uint16_t cp1252[32] =
+{
+	0x20AC,0,0x201A,0x0192,0x201E,0x2026,0x2020,0x2021,0x02C6,0x2030,0x0160,0x2039,0x0152,0,0x017D,0,
+	0,0x2018,0x2019,0x201C,0x201D,0x2022,0x2013,0x2014,0x02DC,0x2122,0x0161,0x203A,0x0153,0,0x017E,0x0178
+};
+
+/* output len chars of str as contents of a JSON string, escaping necessary
+// characters and converting Windows-1252 text to UTF-8 */
+void putjson(FILE* f, const char* str, long len)
+{
+	unsigned int ch;
+
+	while (len-- > 0)
+	{
+		ch = (unsigned char)*str++;
+		if (ch == '"' || ch == '\\')
+		{
+			putc('\\', f);
+			putc(ch, f);
+		}
+		else if (ch == '\n')
+		{
+			fputs("\\n", f);
+		}
+		else if (ch == '\t')
+		{
+			fputs("\\t", f);
+		}
+		else if (ch < 0x20)
+		{
+			fprintf(f, "\\u%04x", ch);
+		}
+		else if (ch < 0x80)
+		{
+			putc(ch, f);
+		}
+		else
+		{
+			if (ch < 0xA0) ch = cp1252[ch - 0x80] ? cp1252[ch - 0x80] : 0xFFFD;
+			if (ch < 0x800)
+			{
+				putc(0xC0 | (ch >> 6), f);
+			}
+			else
+			{
+				putc(0xE0 | (ch >> 12), f);
+				putc(0x80 | ((ch >> 6) & 0x3F), f);
+			}
+			putc(0x80 | (ch & 0x3F), f);
+		}
+	}
+}
+
 /* scan-functions for reading compressed values from LinkData1 */
 int16_t scanint(char** ptr) /* scan a compressed short */
 {
@@ -668,6 +869,7 @@ BOOL SearchFile(FILE* HelpFile, const char* FileName, long* FileLength)
 	char TempFile[NAME_MAX];
 	int i, n;
 
+	if (stats) Stats.SearchFiles++;
 	fseek(HelpFile, 0L, SEEK_SET);
 	read_HELPHEADER(&Header, HelpFile);
 	if (Header.Magic != 0x00035F3FL) return FALSE;
@@ -1146,6 +1348,7 @@ w(Unknown)
 w(NEntries)
 w(PreviousPage)
 obj->NextPage = 0;
+if (stats) Stats.BTreePages++;
 e
 
 s(BTREENODEHEADER)
@@ -1153,6 +1356,7 @@ w(Unknown)
 w(NEntries)
 w(PreviousPage)
 w(NextPage)
+if (stats) Stats.BTreePages++;
 e
 
 s(SYSTEMHEADER)
@@ -23,6 +23,7 @@ http://www.gnu.org
 #define _CRT_NONSTDC_NO_WARNINGS
 
 #include "helpdeco.h"
+#include "libhelpdeco.h"
 
 /* necessary compiler options for 16 bit version using Borland C/C++:
 //   bcc -ml -K -Os -p helpdeco.c helpdec1.c
@@ -55,6 +56,9 @@ BOOL mvp, multi;
 BOOL warnings, missing;
 int32_t* Topic;
 int Topics;			    /* 16 bit: max. 16348 Topics */
+#define TOPICHASHSIZE 4099 /* buckets of TopicHash, prime */
+int TopicHash[TOPICHASHSIZE]; /* lowest index of Topic by its value, see TopicHashBuild */
+int* TopicNext;
 GROUP* group;
 int groups;
 CONTEXTREC* ContextRec;
@@ -62,6 +66,14 @@ int ContextRecs;		    /* 16 bit: max. 8191 Context Records */
 ALTERNATIVE* alternative;
 int alternatives;
 BOOL overwriteFile = FALSE;
+int stats; /* option --stats: 1 = table, 2 = JSON */
+STATS Stats; /* counted all the time, cheap enough */
+#define STATSPHASES 16
+STATSPHASE StatsPhase[STATSPHASES]; /* phases ended by StatsBegin */
+int StatsPhases;
+const char* StatsName; /* current phase, NULL if none */
+STATS StatsStart; /* Stats, WallTime and clock at start of current phase */
+double StatsWall, StatsCpu;
 BOOL exportLZ77 = FALSE;
 BOOL extractmacros = TRUE;
 BOOL guessing = TRUE;
@@ -76,12 +88,19 @@ BOOL exportplain = FALSE;
 int NextKeywordRec, KeywordRecs;
 KEYWORDREC* KeywordRec;
 TOPICOFFSET NextKeywordOffset;
+int VIOLAfound = -1; /* |VIOLA: -1 not looked for yet, 0 none or done, 1 Viola loaded */
+VIOLAREC* Viola; /* current page of |VIOLA, see ListWindows */
 char helpcomp[13];
 char HelpFileTitle[NAME_MAX];
 char TopicTitle[256];
 char* Phrases;
 unsigned int* PhraseOffsets;
 unsigned int PhraseCount;
+PHRASESPAN* PhraseSpan; /* PhraseCount entries, built by PhraseLoad */
+FILE* PhraseFile; /* set by PhraseDefer until phrases are needed */
+#define PHRASEPAD 16 /* Phrases is allocated this much larger for fixed size copies */
+enum { HALL_PHRASE, HALL_LONGPHRASE, HALL_COPY, HALL_SPACES, HALL_NULS };
+unsigned char HallOp[256], HallArg[256]; /* Hall code byte decoded by PhraseLoad */
 long TopicFileLength;
 int TopicBlockSize; /* 2k or 4k */
 int DecompressSize; /* 4k or 16k */
@@ -90,6 +109,16 @@ char keyword[512];
 char index_separators[40] = ",;";
 char* extension;
 int extensions = 0;
+BOOL uniquebitmaps = FALSE;
+ANNOREC* annorec; /* sorted index of AnnoFile, built on first Annotate */
+int annorecs;
+BITMAPREC* bitmaprec; /* images exported so far if uniquebitmaps */
+int bitmaprecs;
+#define BITMAPHASHSIZE 1021 /* buckets of BitmapHash, prime */
+int BitmapHash[BITMAPHASHSIZE]; /* latest bitmaprec by FNV-1a hash of image */
+long BitmapWritten; /* size of file last written by ExtractBitmap */
+int* bitmapalias; /* 1 + number of the identical bitmap exported instead, or 0 */
+int bitmapaliases;
 /* index into bmpext: bit 0=multiresolution bit 1=bitmap, bit 2=metafile, bit 3=hotspot data, bit 4=embedded, bit 5=transparent */
 char* bmpext[] = { "???","mrb","bmp","mrb","wmf","mrb","mrb","mrb","shg","mrb","shg","mrb","shg","mrb","shg","mrb" };
 char** stopwordfilename;
@@ -106,6 +135,50 @@ char** windowname;
 int windownames;
 BOOL NotInAnyTopic;
 int TopicsPerRTF;
+long RenderTopic; /* if not 0, TopicDump writes only this topic (1 = first one at RenderPos) */
+TOPICPOS RenderPos; /* if not 0, TopicDump starts at this topic header */
+TOPICOFFSET RenderOffset; /* TopicOffset at RenderPos */
+char* RenderId; /* topic to render for option -j */
+char* QueryWords; /* words to look up in full text index for option -q */
+char* KeywordId; /* [list:]prefix or [list:]#number of keyword for option -k */
+FILE* KeywordFile; /* help file KeywordPrint looks up titles in */
+FILE* BitmapFile; /* set by BitmapDefer, bitmaps are scanned when named */
+char IndexFileName[PATH_MAX]; /* topic index next to help file, see IndexWrite */
+TOPICINDEXREC* TopicIndex; /* loaded by IndexLoad */
+long TopicIndexRecs;
+char* TopicIndexTitles;
+TITLEREC* TitleRec; /* all of |TTLBTREE, loaded by TitleLoad */
+long TitleRecs;
+char* TitleStrings;
+ARENA LinkArena; /* scratch memory of the current TOPICLINK, see ArenaAlloc */
+#define REFHASHSIZE 1024 /* buckets of filerefhash and checkrechash */
+FILEREF* filerefhash[REFHASHSIZE]; /* external files by FileNameKey */
+CHECKREC* checkrechash[REFHASHSIZE]; /* references by file, type and hash */
+ARENA RefArena; /* ids and topic names of external references, see ReferencesFree */
+char* RefTitle; /* topic name of last place stored in RefArena */
+ARENA JsonArena; /* strings of JsonLink, reset after each topic */
+JSONLINKREC* JsonLink; /* jumps and popups of topic written by -o json */
+int JsonLinks;
+enum { TEXT_PLAIN, TEXT_JSON, TEXT_WORDS }; /* output format of TextDump */
+char WordIndexFileName[PATH_MAX]; /* full text index next to help file, see WordIndexWrite */
+#define WORDHASHSIZE 16384 /* buckets of WordHash */
+int32_t WordHash[WORDHASHSIZE]; /* WordRec by hash of name */
+WORDREC* WordRec;
+long WordRecs;
+WORDPOSREC* WordPos;
+long WordPosRecs, WordPosAlloc;
+ARENA WordArena; /* names of WordRec */
+TOPICINDEXREC* WordTopicRec; /* topic offset and title of indexed topics */
+long WordTopics;
+char* WordTitles;
+long WordTitleSize;
+char Word[64]; /* word being scanned, lower case */
+int WordLen;
+uint32_t WordNum; /* number of words seen in current topic */
+char** StopWord; /* sorted, loaded by StopLoad */
+int StopWords;
+char* RTFHeader; /* fonttbl, colortbl, and styletbl as written by FontLoad */
+long RTFHeaderLength, RTFHeaderSize;
 BOOL lists['z' - '0' + 1];
 BOOL keyindex['z' - '0' + 1];
 static signed char table[256] =
@@ -465,7 +538,7 @@ void SysLoad(FILE* HelpFile) /* gets global values from SYSTEM file */
 	if (!SearchFile(HelpFile, "|SYSTEM", NULL))
 	{
 		fputs("Internal |SYSTEM file not found. Can't continue.\n", stderr);
-		exit(1);
+		quit(1);
 	}
 	read_SYSTEMHEADER(&SysHdr, HelpFile);
 	before31 = SysHdr.Minor < 16;
@@ -622,48 +695,157 @@ int filenamecmp(const char* a, const char* b)
 	return strcmpi(aext, bext);
 }
 
+/* normalizes filename into key as compared by filenamecmp (lower case
+// name and extension, .hlp if none), returns hash value of key */
+unsigned int FileNameKey(const char* filename, char* key)
+{
+	char fname[NAME_MAX], fext[_MAX_EXT];
+	unsigned int h;
+	char* ptr;
+
+	_splitpath(filename, NULL, NULL, fname, fext);
+	if (fext[0] == '\0') strcpy(fext, ".hlp");
+	strcpy(key, fname);
+	strcat(key, fext);
+	h = 0;
+	for (ptr = key; *ptr; ptr++)
+	{
+		*ptr = tolower((unsigned char)*ptr);
+		h = h * 31 + (unsigned char)*ptr;
+	}
+	return h;
+}
+
 /* store external reference in list, checked later */
 void StoreReference(char* filename, int type, char* id, int32_t hash)
 {
+	char key[NAME_MAX + _MAX_EXT];
 	CHECKREC* ptr;
 	FILEREF* ref;
 	PLACEREC* place;
+	unsigned int h, keyhash;
 
-	for (ref = external; ref; ref = ref->next)
+	keyhash = FileNameKey(filename, key);
+	h = keyhash % REFHASHSIZE;
+	for (ref = filerefhash[h]; ref; ref = ref->hashnext)
 	{
-		if (filenamecmp(filename, ref->filename) == 0) break;
+		if (strcmp(key, ref->key) == 0) break;
 	}
 	if (!ref)
 	{
 		ref = my_malloc(sizeof(FILEREF) + strlen(filename));
 		strcpy(ref->filename, filename);
+		ref->key = strcpy(ArenaAlloc(&RefArena, strlen(key) + 1), key);
+		ref->keyhash = keyhash;
 		ref->check = NULL;
 		ref->next = external;
 		external = ref;
+		ref->hashnext = filerefhash[h];
+		filerefhash[h] = ref;
 	}
-	for (ptr = ref->check; ptr; ptr = ptr->next)
+	h = (ref->keyhash + (unsigned int)hash * 2 + type) % REFHASHSIZE;
+	for (ptr = checkrechash[h]; ptr; ptr = ptr->hashnext)
 	{
-		if (ptr->type == type && ptr->hash == hash) break;
+		if (ptr->file == ref && ptr->type == type && ptr->hash == hash) break;
 	}
 	if (!ptr)
 	{
 		ptr = my_malloc(sizeof(CHECKREC));
+		ptr->file = ref;
 		ptr->type = type;
 		ptr->hash = hash;
-		ptr->id = my_strdup(id);
+		ptr->id = id ? strcpy(ArenaAlloc(&RefArena, strlen(id) + 1), id) : NULL;
 		ptr->here = NULL;
 		ptr->next = ref->check;
 		ref->check = ptr;
+		ptr->hashnext = checkrechash[h];
+		checkrechash[h] = ptr;
 	}
 	if (listtopic && TopicTitle[0])
 	{
-		place = my_malloc(sizeof(PLACEREC) + strlen(TopicTitle));
-		strcpy(place->topicname, TopicTitle);
+		if (!RefTitle || strcmp(RefTitle, TopicTitle) != 0)
+		{
+			RefTitle = strcpy(ArenaAlloc(&RefArena, strlen(TopicTitle) + 1), TopicTitle);
+		}
+		place = ArenaAlloc(&RefArena, sizeof(PLACEREC));
+		place->topicname = RefTitle;
 		place->next = ptr->here;
 		ptr->here = place;
 	}
 }
 
+/* forget all external references stored */
+void ReferencesFree(void)
+{
+	FILEREF* ref;
+	CHECKREC* ptr;
+
+	while ((ref = external) != NULL)
+	{
+		while ((ptr = ref->check) != NULL)
+		{
+			ref->check = ptr->next;
+			free(ptr);
+		}
+		external = ref->next;
+		free(ref);
+	}
+	memset(filerefhash, 0, sizeof(filerefhash));
+	memset(checkrechash, 0, sizeof(checkrechash));
+	ArenaFree(&RefArena);
+	RefTitle = NULL;
+}
+
+int Int32Cmp(const void* a, const void* b)
+{
+	if (*(const int32_t*)a < *(const int32_t*)b) return -1;
+	if (*(const int32_t*)a > *(const int32_t*)b) return 1;
+	return 0;
+}
+
+/* load sorted map ids of |CTXOMAP (if ctxomap) or context id hash values of
+// |CONTEXT of help file f, returns number of values stored in *values */
+int LoadReferenceTargets(FILE* f, BOOL ctxomap, int32_t** values)
+{
+	BUFFER buf;
+	CTXOMAPREC CTXORec;
+	CONTEXTREC ContextRec;
+	long entries;
+	int i, n, count;
+
+	count = 0;
+	*values = my_malloc(sizeof(int32_t));
+	if (ctxomap)
+	{
+		if (SearchFile(f, "|CTXOMAP", NULL))
+		{
+			n = my_getw(f);
+			*values = my_realloc(*values, (n + 1) * sizeof(int32_t));
+			for (i = 0; i < n; i++)
+			{
+				read_CTXOMAPREC(&CTXORec, f);
+				(*values)[count++] = CTXORec.MapID;
+			}
+		}
+	}
+	else if (SearchFile(f, "|CONTEXT", NULL))
+	{
+		n = GetFirstPage(f, &buf, &entries);
+		*values = my_realloc(*values, (entries + 1) * sizeof(int32_t));
+		while (n)
+		{
+			for (i = 0; i < n && count < entries; i++)
+			{
+				read_CONTEXTREC(&ContextRec, f);
+				(*values)[count++] = ContextRec.HashValue;
+			}
+			n = GetNextPage(f, &buf);
+		}
+	}
+	qsort(*values, count, sizeof(int32_t), Int32Cmp);
+	return count;
+}
+
 /* validate each entry in list of external references */
 void CheckReferences(void)
 {
@@ -671,12 +853,9 @@ void CheckReferences(void)
 	CHECKREC* ptr;
 	FILE* f;
 	BOOL found;
-	long offset;
-	int i, n;
-	CTXOMAPREC CTXORec;
-	BTREEHEADER BTreeHdr;
-	BTREENODEHEADER CurrNode;
-	CONTEXTREC ContextRec;
+	int32_t* mapid;
+	int32_t* hashvalue;
+	int mapids, hashvalues;
 
 	for (ref = external; ref; ref = ref->next)
 	{
@@ -689,52 +868,19 @@ void CheckReferences(void)
 		{
 			if (SearchFile(f, NULL, NULL))
 			{
+				mapid = hashvalue = NULL;
+				mapids = hashvalues = 0;
 				for (ptr = ref->check; ptr; ptr = ptr->next)
 				{
-					found = FALSE;
 					if (ptr->type == CONTEXT)
 					{
-						if (SearchFile(f, "|CTXOMAP", NULL))
-						{
-							n = my_getw(f);
-							for (i = 0; i < n; i++)
-							{
-								read_CTXOMAPREC(&CTXORec, f);
-								if (CTXORec.MapID == ptr->hash) /* hash is context id */
-								{
-									found = TRUE;
-									break;
-								}
-							}
-						}
+						if (!mapid) mapids = LoadReferenceTargets(f, TRUE, &mapid);
+						found = bsearch(&ptr->hash, mapid, mapids, sizeof(int32_t), Int32Cmp) != NULL; /* hash is context id */
 					}
 					else
 					{
-						if (SearchFile(f, "|CONTEXT", NULL))
-						{
-							read_BTREEHEADER(&BTreeHdr, f);
-							offset = ftell(f);
-							CurrNode.PreviousPage = BTreeHdr.RootPage;
-							for (n = 1; n < BTreeHdr.NLevels; n++)
-							{
-								fseek(f, offset + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
-								read_BTREEINDEXHEADER_to_BTREENODEHEADER(&CurrNode, f);
-								for (i = 0; i < CurrNode.NEntries; i++)
-								{
-									ContextRec.HashValue = getdw(f);
-									if (ContextRec.HashValue > ptr->hash) break;
-									CurrNode.PreviousPage = my_getw(f); /* Page */
-								}
-							}
-							fseek(f, offset + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
-							read_BTREENODEHEADER(&CurrNode, f);
-							for (i = 0; i < CurrNode.NEntries; i++)
-							{
-								read_CONTEXTREC(&ContextRec, f);
-								if (ContextRec.HashValue == ptr->hash) found = TRUE;
-								if (ContextRec.HashValue >= ptr->hash) break;
-							}
-						}
+						if (!hashvalue) hashvalues = LoadReferenceTargets(f, FALSE, &hashvalue);
+						found = bsearch(&ptr->hash, hashvalue, hashvalues, sizeof(int32_t), Int32Cmp) != NULL;
 					}
 					if (!found)
 					{
@@ -753,6 +899,8 @@ void CheckReferences(void)
 						}
 					}
 				}
+				if (mapid) free(mapid);
+				if (hashvalue) free(hashvalue);
 			}
 			else
 			{
@@ -1098,37 +1246,75 @@ int ExtractBitmap(char* szFilename, MFILE* f)
 					bmih.biSizeImage = (((bmih.biWidth * bmih.biBitCount + 31) / 32) * 4) * bmih.biHeight;
 					if (byType == 5) /* convert DDB to DIB */
 					{
-						long width, length;
+						long width, stride, length, size;
 						unsigned char count, value;
-						int pad;
-
+						unsigned char* image;
+						unsigned char* packed;
+						unsigned char* row;
+						unsigned char* src;
+						unsigned char* end;
+						int c;
+
+						/* DDB rows are word aligned, DIB rows dword aligned. The
+						// whole DIB is built in memory, padding stays 0 */
 						width = ((bmih.biWidth * bmih.biBitCount + 15) / 16) * 2;
-						pad = (int)(((width + 3) / 4) * 4 - width);
-						count = value = 0;
-						for (l = 0; l < bmih.biHeight; l++)
+						stride = ((width + 3) / 4) * 4;
+						size = stride * bmih.biHeight;
+						if (size > 0 && (size_t)size == size)
 						{
-							if (byPacked == 1)
+							image = my_malloc(size);
+							memset(image, 0, (size_t)size);
+							packed = src = end = NULL;
+							if (byPacked == 1 && dwDataSize > 0 && (size_t)dwDataSize == dwDataSize)
+							{
+								packed = my_malloc(dwDataSize);
+								for (end = packed; end < packed + dwDataSize && (c = f->get(f)) != -1; end++) *end = c;
+								src = packed;
+							}
+							count = value = 0;
+							for (row = image, l = 0; l < bmih.biHeight; l++, row += stride)
 							{
-								for (length = 0; length < width; length++)
+								if (byPacked == 1)
 								{
-									if ((count & 0x7F) == 0)
-									{
-										count = f->get(f);
-										value = f->get(f);
-									}
-									else if (count & 0x80)
+									/* runs may continue into the next row */
+									for (length = 0; length < width && src < end; length += i)
 									{
-										value = f->get(f);
+										if ((count & 0x7F) == 0)
+										{
+											count = *src++;
+											if (src >= end) break;
+											value = *src++;
+											row[length] = value;
+											count--;
+											i = 1;
+										}
+										else
+										{
+											i = count & 0x7F;
+											if (i > width - length) i = (unsigned int)(width - length);
+											if (count & 0x80) /* i literal bytes */
+											{
+												if (i > end - src) i = (unsigned int)(end - src);
+												memcpy(row + length, src, i);
+												src += i;
+												value = src[-1];
+											}
+											else /* i times value */
+											{
+												memset(row + length, value, i);
+											}
+											count -= i;
+										}
 									}
-									putc(value, fTarget);
-									count--;
+								}
+								else
+								{
+									f->read(f, row, width);
 								}
 							}
-							else
-							{
-								CopyBytes(f, width, fTarget);
-							}
-							if (pad) fwrite(buffer, pad, 1, fTarget);
+							fwrite(image, (size_t)size, 1, fTarget);
+							if (packed) free(packed);
+							free(image);
 						}
 					}
 					else
@@ -1334,17 +1520,61 @@ int ExtractBitmap(char* szFilename, MFILE* f)
 			if (dwHotspotSize) putdw(dwPictureOffset + dwDataSize, fTarget);
 		}
 	}
-	if (fTarget) my_fclose(fTarget);
+	if (fTarget)
+	{
+		fseek(fTarget, 0L, SEEK_END);
+		BitmapWritten = ftell(fTarget);
+		my_fclose(fTarget);
+	}
 	return type;
 }
 /****************************************************************************
 END OF GRAPHICS STUFF
 **************************************************************************/
 
+/* determine type of bitmap n without extracting it (checkexternal set)
+// and store it in extension, as ExportBitmaps does for all bitmaps */
+void BitmapScan(FILE* HelpFile, unsigned int n)
+{
+	char FileName[20];
+	MFILE* mf;
+	long savepos;
+	int type;
+
+	savepos = ftell(HelpFile);
+	sprintf(FileName, "|bm%u", n);
+	if (SearchFile(HelpFile, FileName + before31, NULL))
+	{
+		mf = CreateVirtual(HelpFile);
+		type = ExtractBitmap(FileName + 1, mf);
+		CloseMap(mf);
+		if (type)
+		{
+			if (n >= extensions)
+			{
+				extension = my_realloc(extension, (n + 1) * sizeof(char));
+				while (extensions <= n) extension[extensions++] = 0;
+			}
+			extension[n] = type;
+		}
+	}
+	fseek(HelpFile, savepos, SEEK_SET);
+}
+
+/* scan bitmaps of HelpFile only when getbitmapname needs their type
+// instead of calling ExportBitmaps for all of them */
+void BitmapDefer(FILE* HelpFile)
+{
+	checkexternal = TRUE;
+	BitmapFile = HelpFile;
+}
+
 char* getbitmapname(unsigned int n) /* retrieve extension of exported bitmap n */
 {
 	static char name[20];
 
+	if (n < bitmapaliases && bitmapalias[n]) n = bitmapalias[n] - 1;
+	if (BitmapFile && !(n < extensions && extension[n])) BitmapScan(BitmapFile, n);
 	if (n < extensions && extension[n])
 	{
 		snprintf(name, sizeof(name), "bm%u.%s", n, bmpext[extension[n] & 0x0F]);
@@ -1371,7 +1601,7 @@ void ListBitmaps(FILE* hpj) /* writes out [BITMAPS] section */
 	if (hpj && extensions)
 	{
 		fputs("[BITMAPS]\n", hpj);
-		for (i = 0; i < extensions; i++) if (extension[i])
+		for (i = 0; i < extensions; i++) if (extension[i] && !(i < bitmapaliases && bitmapalias[i]))
 		{
 			fprintf(hpj, "bm%u.%s\n", i, bmpext[extension[i] & 0x0F]);
 		}
@@ -1379,47 +1609,153 @@ void ListBitmaps(FILE* hpj) /* writes out [BITMAPS] section */
 	}
 }
 
+/* returns the bitmaprec of a bitmap already exported with the same length
+// image bytes of image found at offset in HelpFile, or -1 after
+// remembering it as bitmap num in bitmaprec[bitmaprecs-1] */
+int FindBitmap(FILE* HelpFile, int num, char* image, long length, long offset)
+{
+	uint32_t h;
+	long l;
+	int i, c, key;
+
+	if (!bitmaprecs) for (i = 0; i < BITMAPHASHSIZE; i++) BitmapHash[i] = -1;
+	h = 2166136261UL; /* FNV-1a */
+	for (l = 0; l < length; l++) h = (h ^ (unsigned char)image[l]) * 16777619UL;
+	key = h % BITMAPHASHSIZE;
+	for (i = BitmapHash[key]; i != -1; i = bitmaprec[i].next)
+	{
+		if (bitmaprec[i].hash == h && bitmaprec[i].length == length)
+		{
+			fseek(HelpFile, bitmaprec[i].offset, SEEK_SET);
+			for (l = 0; l < length && (c = getc(HelpFile)) == (unsigned char)image[l]; l++);
+			if (l == length) return i;
+		}
+	}
+	/* %100 to decrease memory fragmentation */
+	if (bitmaprecs % 100 == 0) bitmaprec = my_realloc(bitmaprec, (bitmaprecs + 100) * sizeof(BITMAPREC));
+	bitmaprec[bitmaprecs].hash = h;
+	bitmaprec[bitmaprecs].offset = offset;
+	bitmaprec[bitmaprecs].length = length;
+	bitmaprec[bitmaprecs].exported = 0L;
+	bitmaprec[bitmaprecs].num = num;
+	bitmaprec[bitmaprecs].next = BitmapHash[key];
+	BitmapHash[key] = bitmaprecs++;
+	return -1;
+}
+
 void ExportBitmaps(FILE* HelpFile) /* export all bitmaps */
 {
 	BUFFER buf;
 	MFILE* mf;
+	FILEHEADER FileHdr;
 	char* leader;
 	char FileName[NAME_MAX];
+	char* image;
+	long imagesize;
 	long FileLength;
 	int i, num, n, type;
-	long savepos;
+	long savepos, offset, saved;
+	size_t bytes;
+	int first, duplicates, rec;
 
 	leader = "|bm" + before31;
+	saved = 0L;
+	duplicates = 0;
+	image = NULL;
+	imagesize = 0L;
 	SearchFile(HelpFile, NULL, NULL);
 	for (n = GetFirstPage(HelpFile, &buf, NULL); n; n = GetNextPage(HelpFile, &buf))
 	{
 		for (i = 0; i < n; i++)
 		{
 			my_gets(FileName, sizeof(FileName), HelpFile);
-			getdw(HelpFile);
+			offset = getdw(HelpFile);
 			if (memcmp(FileName, leader, strlen(leader)) == 0)
 			{
 				savepos = ftell(HelpFile);
-				if (SearchFile(HelpFile, FileName, &FileLength))
+				/* the directory entry already tells where the bitmap is, so
+				// go there directly and decode it from memory if it fits */
+				fseek(HelpFile, offset, SEEK_SET);
+				read_FILEHEADER(&FileHdr, HelpFile);
+				FileLength = FileHdr.UsedSpace;
+				if (FileLength > 0L && (size_t)FileLength == FileLength)
 				{
-					mf = CreateVirtual(HelpFile);
-					type = ExtractBitmap(FileName + (FileName[0] == '|'), mf);
-					CloseMap(mf);
-					if (type)
+					if (FileLength > imagesize)
+					{
+						image = my_realloc(image, FileLength);
+						imagesize = FileLength;
+					}
+					bytes = my_fread(image, FileLength, HelpFile);
+					if (uniquebitmaps && (rec = FindBitmap(HelpFile, atoi(FileName + (FileName[0] == '|') + 2), image, (long)bytes, offset + sizeof_FILEHEADER)) >= 0)
 					{
+						/* identical to bitmap first: reference that file instead */
+						first = bitmaprec[rec].num;
 						num = atoi(FileName + (FileName[0] == '|') + 2);
+						if (num >= bitmapaliases)
+						{
+							bitmapalias = my_realloc(bitmapalias, (num + 1) * sizeof(int));
+							while (bitmapaliases <= num) bitmapalias[bitmapaliases++] = 0;
+						}
+						bitmapalias[num] = first + 1;
 						if (num >= extensions)
 						{
 							extension = my_realloc(extension, (num + 1) * sizeof(char));
 							while (extensions <= num) extension[extensions++] = 0;
 						}
-						extension[num] = type;
+						extension[num] = first < extensions ? extension[first] : 0;
+						saved += bitmaprec[rec].exported;
+						duplicates++;
+						fseek(HelpFile, savepos, SEEK_SET);
+						continue;
+					}
+					mf = CreateMap(image, bytes);
+				}
+				else
+				{
+					mf = CreateVirtual(HelpFile);
+				}
+				BitmapWritten = 0L;
+				type = ExtractBitmap(FileName + (FileName[0] == '|'), mf);
+				CloseMap(mf);
+				num = atoi(FileName + (FileName[0] == '|') + 2);
+				if (uniquebitmaps && bitmaprecs && bitmaprec[bitmaprecs - 1].num == num)
+				{
+					bitmaprec[bitmaprecs - 1].exported = BitmapWritten;
+				}
+				if (type)
+				{
+					if (num >= extensions)
+					{
+						extension = my_realloc(extension, (num + 1) * sizeof(char));
+						while (extensions <= num) extension[extensions++] = 0;
 					}
+					extension[num] = type;
 				}
 				fseek(HelpFile, savepos, SEEK_SET);
 			}
 		}
 	}
+	if (image) free(image);
+	if (duplicates)
+	{
+		fprintf(stderr, "%d duplicate bitmaps not written, %ld bytes saved\n", duplicates, saved);
+	}
+}
+
+/* chain Topic[16..] by value in TopicHash, lowest index first */
+void TopicHashBuild(void)
+{
+	int i, key;
+
+	if (TopicNext) free(TopicNext);
+	TopicNext = my_malloc(Topics * sizeof(int));
+	for (i = 0; i < TOPICHASHSIZE; i++) TopicHash[i] = -1;
+	for (i = Topics - 1; i >= 16; i--)
+	{
+		key = (uint32_t)Topic[i] % TOPICHASHSIZE;
+		TopicNext[i] = TopicHash[key];
+		TopicHash[key] = i;
+	}
 }
 
 char* TopicName(int32_t topic)
@@ -1429,8 +1765,8 @@ char* TopicName(int32_t topic)
 
 	if (before31)
 	{
-		if (topic == 0L) topic = Topic[0];
-		for (i = 16; i < Topics; i++) if (Topic[i] == topic)
+		if (topic == 0L && Topics) topic = Topic[0];
+		for (i = Topics ? TopicHash[(uint32_t)topic % TOPICHASHSIZE] : -1; i != -1; i = TopicNext[i]) if (Topic[i] == topic)
 		{
 			sprintf(name, "TOPIC%d", i);
 			return name;
@@ -1848,6 +2184,80 @@ void SysList(FILE* HelpFile, FILE* hpj, char* IconFileName)
 	}
 }
 
+/* build PhraseSpan from PhraseOffsets, clipping phrases to the size
+// bytes loaded into Phrases */
+void PhraseSpans(long size)
+{
+	unsigned int n;
+	long start, end;
+
+	PhraseSpan = my_malloc(sizeof(PHRASESPAN) * (PhraseCount + 1));
+	for (n = 0; n < PhraseCount; n++)
+	{
+		start = PhraseOffsets[n];
+		end = PhraseOffsets[n + 1];
+		if (start > size) start = size;
+		if (end > size) end = size;
+		if (end < start) end = start;
+		PhraseSpan[n].ptr = Phrases + start;
+		PhraseSpan[n].len = (unsigned int)(end - start);
+	}
+	memset(Phrases + size, 0, PHRASEPAD);
+}
+
+/* fill PhraseOffsets from the phrase lengths in the |PhrIndex bitstream of
+// size bytes at the current position of HelpFile. A length is coded as a
+// run of 1 bits each adding 1<<bits, a 0 bit, and the remainder-1 in the
+// next bits bits (at least 1, at most 5). Bits are taken lsb first from
+// 32 bit words, so the bitstream is equally read lsb first byte by byte */
+void PhraseIndexDecode(FILE* HelpFile, long size, int bits)
+{
+	static unsigned char TrailingOnes[256];
+	unsigned char* stream;
+	unsigned char* p;
+	unsigned long pos, window;
+	unsigned int ones, remainder, n;
+	long l, offset;
+
+	if (!TrailingOnes[1])
+	{
+		for (n = 0; n < 256; n++)
+		{
+			for (ones = 0; n & (1 << ones); ones++);
+			TrailingOnes[n] = ones;
+		}
+	}
+	remainder = bits < 1 ? 1 : bits > 5 ? 5 : bits;
+	if (size < 0) size = 0;
+	stream = my_malloc(size + 8);
+	size = (long)my_fread(stream, size, HelpFile);
+	memset(stream + size, 0, 8); /* stops runs of 1 bits beyond the end */
+	pos = 0;
+	offset = 0;
+	PhraseOffsets[0] = offset;
+	for (l = 0; l < (long)PhraseCount; l++)
+	{
+		n = 1;
+		for (;;)
+		{
+			if (pos / 8 > (unsigned long)size) pos = size * 8L; /* corrupt: keep reading zero padding */
+			p = stream + pos / 8;
+			window = (p[0] | p[1] << 8 | (unsigned long)p[2] << 16) >> (pos % 8);
+			if ((window & 0xFF) != 0xFF) break;
+			n += 8 << bits;
+			pos += 8;
+		}
+		ones = TrailingOnes[window & 0xFF];
+		n += ones << bits;
+		window >>= ones + 1;
+		n += window & ((1 << remainder) - 1);
+		pos += ones + 1 + remainder;
+		offset += n;
+		PhraseOffsets[l + 1] = offset;
+	}
+	free(stream);
+}
+
 /* load phrases for decompression from old Phrases file or new PhrIndex,
 // PhrImage files of HCRTF */
 BOOL PhraseLoad(FILE* HelpFile)
@@ -1858,9 +2268,9 @@ BOOL PhraseLoad(FILE* HelpFile)
 	PHRINDEXHDR PhrIndexHdr;
 	unsigned int n;
 	long l, offset;
-	long SavePos;
+	long SavePos, IndexLength;
 
-	if (SearchFile(HelpFile, "|PhrIndex", NULL))
+	if (SearchFile(HelpFile, "|PhrIndex", &IndexLength))
 	{
 		read_PHRINDEXHDR(&PhrIndexHdr, HelpFile);
 		SavePos = ftell(HelpFile);
@@ -1872,7 +2282,7 @@ BOOL PhraseLoad(FILE* HelpFile)
 			}
 			PhraseCount = (unsigned int)PhrIndexHdr.entries;
 			PhraseOffsets = my_malloc(sizeof(unsigned int) * (PhraseCount + 1));
-			Phrases = my_malloc(PhrIndexHdr.phrimagesize);
+			Phrases = my_malloc(PhrIndexHdr.phrimagesize + PHRASEPAD);
 			if (PhrIndexHdr.phrimagesize == PhrIndexHdr.phrimagecompressedsize)
 			{
 				my_fread(Phrases, PhrIndexHdr.phrimagesize, HelpFile);
@@ -1882,23 +2292,33 @@ BOOL PhraseLoad(FILE* HelpFile)
 				DecompressIntoBuffer(2, HelpFile, FileLength, (char*)Phrases, PhrIndexHdr.phrimagesize);
 			}
 			fseek(HelpFile, SavePos, SEEK_SET);
-			GetBit(NULL);
-			offset = 0;
-			PhraseOffsets[0] = offset;
-			for (l = 0; l < PhrIndexHdr.entries; l++)
+			PhraseIndexDecode(HelpFile, IndexLength - sizeof_PHRINDEXHDR, PhrIndexHdr.bits);
+			PhraseSpans(PhrIndexHdr.phrimagesize);
+		}
+		for (n = 0; n < 256; n++)
+		{
+			if ((n & 1) == 0) /* phrases 0..127 */
+			{
+				HallOp[n] = HALL_PHRASE;
+				HallArg[n] = n / 2;
+			}
+			else if ((n & 3) == 1) /* phrases 128..16511 */
+			{
+				HallOp[n] = HALL_LONGPHRASE;
+				HallArg[n] = n / 4;
+			}
+			else if ((n & 7) == 3) /* copy next n characters */
+			{
+				HallOp[n] = HALL_COPY;
+				HallArg[n] = n / 8 + 1;
+			}
+			else
 			{
-				for (n = 1; GetBit(HelpFile); n += 1 << PhrIndexHdr.bits);
-				if (GetBit(HelpFile)) n += 1;
-				if (PhrIndexHdr.bits > 1) if (GetBit(HelpFile)) n += 2;
-				if (PhrIndexHdr.bits > 2) if (GetBit(HelpFile)) n += 4;
-				if (PhrIndexHdr.bits > 3) if (GetBit(HelpFile)) n += 8;
-				if (PhrIndexHdr.bits > 4) if (GetBit(HelpFile)) n += 16;
-				offset += n;
-				PhraseOffsets[(int)l + 1] = offset;
+				HallOp[n] = (n & 0x0F) == 0x07 ? HALL_SPACES : HALL_NULS;
+				HallArg[n] = n / 16 + 1;
 			}
 		}
 		Hall = TRUE;
-		fprintf(stderr, "%u phrases loaded\n", PhraseCount);
 	}
 	else if (SearchFile(HelpFile, "|Phrases", &FileLength))
 	{
@@ -1935,15 +2355,21 @@ BOOL PhraseLoad(FILE* HelpFile)
 			}
 			PhraseOffsets = my_malloc(sizeof(unsigned int) * (PhraseCount + 1));
 			for (n = 0; n <= PhraseCount; n++) PhraseOffsets[n] = my_getw(HelpFile) - offset;
-			Phrases = my_malloc(l);
+			Phrases = my_malloc(l + PHRASEPAD);
 			DecompressIntoBuffer((before31 ? 0 : 2), HelpFile, FileLength, Phrases, l);
-			fprintf(stderr, "%u phrases loaded\n", PhraseCount);
+			PhraseSpans(l);
 		}
 		Hall = FALSE;
 	}
 	return TRUE;
 }
 
+/* load phrases from HelpFile only when TopicPhraseRead first needs them */
+void PhraseDefer(FILE* HelpFile)
+{
+	PhraseFile = HelpFile;
+}
+
 /* write phrase PhraseNum to out and returns advanced out
 // or to f it out = NULL or uses PrintString if f = NULL, returns NULL then */
 char* PrintPhrase(unsigned int PhraseNum, char* out, FILE* f)
@@ -2022,6 +2448,45 @@ unsigned char AddColor(unsigned char r, unsigned char g, unsigned char b)
 	return n;
 }
 
+/* append formatted text to RTFHeader */
+void HeaderPrintf(const char* format, ...)
+{
+	va_list arg;
+	int len;
+
+	len = 0;
+	for (;;)
+	{
+		if (RTFHeaderSize - RTFHeaderLength <= len) /* double to decrease memory fragmentation */
+		{
+			RTFHeaderSize = 2 * RTFHeaderSize + len + 0x400L;
+			RTFHeader = my_realloc(RTFHeader, RTFHeaderSize);
+		}
+		va_start(arg, format);
+		len = vsnprintf(RTFHeader + RTFHeaderLength, RTFHeaderSize - RTFHeaderLength, format, arg);
+		va_end(arg);
+		if (len < 0)
+		{
+			error("HeaderPrintf(%s) failed", format);
+			return;
+		}
+		if (len < RTFHeaderSize - RTFHeaderLength) break;
+	}
+	RTFHeaderLength += len;
+}
+
+/* write fonttbl, colortbl, and styletbl built by FontLoad to rtf file and
+// reset current font. Used for every RTF file if option -s splits output */
+void FontHeader(FILE* rtf)
+{
+	if (RTFHeader)
+	{
+		fwrite(RTFHeader, RTFHeaderLength, 1, rtf);
+		memset(&CurrentFont, 0, sizeof(CurrentFont));
+		CurrentFont.FontName = DefFont;
+	}
+}
+
 /* load fonts from help file, filling up internal font structure,
 // writing fonttbl, colortbl, and styletbl to rtf file */
 void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
@@ -2055,7 +2520,7 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 		if (FontHdr.DescriptorsOffset < FontHdr.FacenamesOffset)
 		{
 			fprintf(stderr, "malformed FONT file\n");
-			exit(1);
+			quit(1);
 		}
 		fontnames = FontHdr.NumFacenames;
 		if (fontnames)
@@ -2069,7 +2534,7 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 		}
 		if (len > FontName_len) {
 			fprintf(stderr, "malformed |FONT file\n");
-			exit(1);
+			quit(1);
 		}
 		fontname = my_malloc(fontnames * sizeof(char*));
 		family = my_malloc(fontnames * sizeof(unsigned char));
@@ -2287,21 +2752,22 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 				}
 			}
 		}
-		fprintf(rtf, "{\\rtf1\\ansi\\deff%d\n{\\fonttbl", DefFont);
+		RTFHeaderLength = 0L;
+		HeaderPrintf("{\\rtf1\\ansi\\deff%d\n{\\fonttbl", DefFont);
 		for (i = 0; i < fontnames; i++)
 		{
-			fprintf(rtf, "{\\f%d\\f%s %s;}", i, FontFamily(family[i]), fontname[i]);
+			HeaderPrintf("{\\f%d\\f%s %s;}", i, FontFamily(family[i]), fontname[i]);
 			free(fontname[i]);
 		}
 		free(fontname);
-		fputs("}\n", rtf);
+		HeaderPrintf("}\n");
 		if (colors > 1)
 		{
-			fputs("{\\colortbl;", rtf);
-			for (i = 1; i < colors; i++) fprintf(rtf, "\\red%d\\green%d\\blue%d;", color[i].r, color[i].g, color[i].b);
-			fputs("}\n", rtf);
+			HeaderPrintf("{\\colortbl;");
+			for (i = 1; i < colors; i++) HeaderPrintf("\\red%d\\green%d\\blue%d;", color[i].r, color[i].g, color[i].b);
+			HeaderPrintf("}\n");
 		}
-		fprintf(rtf, "{\\stylesheet{\\fs%d \\snext0 Normal;}\n", font[0].HalfPoints);
+		HeaderPrintf("{\\stylesheet{\\fs%d \\snext0 Normal;}\n", font[0].HalfPoints);
 		if (mvbstyle)
 		{
 			for (i = 0; i < FontHdr.NumFormats; i++)
@@ -2309,41 +2775,41 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 				MVBSTYLE* m, * n;
 
 				m = mvbstyle + i;
-				fprintf(rtf, "{\\*\\cs%u \\additive", m->StyleNum + 9);
+				HeaderPrintf("{\\*\\cs%u \\additive", m->StyleNum + 9);
 				if (m->BasedOn)
 				{
 					n = mvbstyle + (m->BasedOn - 1);
-					if (m->font.FontName != n->font.FontName) fprintf(rtf, "\\f%d", m->font.FontName);
-					if (m->font.expndtw != n->font.expndtw) fprintf(rtf, "\\expndtw%d", m->font.expndtw);
-					if (m->font.FGRGB[0] != n->font.FGRGB[0]) fprintf(rtf, "\\cf%d", m->font.FGRGB[0]);
-					if (m->font.BGRGB[0] != n->font.BGRGB[0]) fprintf(rtf, "\\cb%d", m->font.BGRGB[0]);
-					if (m->font.Height != n->font.Height) fprintf(rtf, "\\fs%ld", -2L * m->font.Height);
-					if ((m->font.Weight > 500) != (n->font.Weight > 500)) fprintf(rtf, "\\b%d", m->font.Weight > 500);
-					if (m->font.Italic != n->font.Italic) fprintf(rtf, "\\i%d", m->font.Italic);
-					if (m->font.Underline != n->font.Underline) fprintf(rtf, "\\ul%d", m->font.Underline);
-					if (m->font.StrikeOut != n->font.StrikeOut) fprintf(rtf, "\\strike%d", m->font.StrikeOut);
-					if (m->font.DoubleUnderline != n->font.DoubleUnderline) fprintf(rtf, "\\uldb%d", m->font.DoubleUnderline);
-					if (m->font.SmallCaps != n->font.SmallCaps) fprintf(rtf, "\\scaps%d", m->font.SmallCaps);
-					if (m->font.up != n->font.up) fprintf(rtf, "\\up%d", abs(m->font.up));
-					fprintf(rtf, " \\sbasedon%u", m->BasedOn + 9);
+					if (m->font.FontName != n->font.FontName) HeaderPrintf("\\f%d", m->font.FontName);
+					if (m->font.expndtw != n->font.expndtw) HeaderPrintf("\\expndtw%d", m->font.expndtw);
+					if (m->font.FGRGB[0] != n->font.FGRGB[0]) HeaderPrintf("\\cf%d", m->font.FGRGB[0]);
+					if (m->font.BGRGB[0] != n->font.BGRGB[0]) HeaderPrintf("\\cb%d", m->font.BGRGB[0]);
+					if (m->font.Height != n->font.Height) HeaderPrintf("\\fs%ld", -2L * m->font.Height);
+					if ((m->font.Weight > 500) != (n->font.Weight > 500)) HeaderPrintf("\\b%d", m->font.Weight > 500);
+					if (m->font.Italic != n->font.Italic) HeaderPrintf("\\i%d", m->font.Italic);
+					if (m->font.Underline != n->font.Underline) HeaderPrintf("\\ul%d", m->font.Underline);
+					if (m->font.StrikeOut != n->font.StrikeOut) HeaderPrintf("\\strike%d", m->font.StrikeOut);
+					if (m->font.DoubleUnderline != n->font.DoubleUnderline) HeaderPrintf("\\uldb%d", m->font.DoubleUnderline);
+					if (m->font.SmallCaps != n->font.SmallCaps) HeaderPrintf("\\scaps%d", m->font.SmallCaps);
+					if (m->font.up != n->font.up) HeaderPrintf("\\up%d", abs(m->font.up));
+					HeaderPrintf(" \\sbasedon%u", m->BasedOn + 9);
 				}
 				else
 				{
-					fprintf(rtf, "\\f%d", m->font.FontName);
-					if (m->font.Italic) fputs("\\i", rtf);
-					if (m->font.Weight > 500) fputs("\\b", rtf);
-					if (m->font.Underline) fputs("\\ul", rtf);
-					if (m->font.StrikeOut) fputs("\\strike", rtf);
-					if (m->font.DoubleUnderline) fputs("\\uldb", rtf);
-					if (m->font.SmallCaps) fputs("\\scaps", rtf);
-					if (m->font.expndtw) fprintf(rtf, "\\expndtw%d", m->font.expndtw);
-					if (m->font.up > 0) fprintf(rtf, "\\up%d", m->font.up);
-					else if (m->font.up < 0) fprintf(rtf, "\\dn%d", -m->font.up);
-					fprintf(rtf, "\\fs%d", -2 * m->font.Height);
-					if (m->font.FGRGB[0]) fprintf(rtf, "\\cf%d", m->font.FGRGB[0]);
-					if (m->font.BGRGB[0]) fprintf(rtf, "\\cb%d", m->font.BGRGB[0]);
+					HeaderPrintf("\\f%d", m->font.FontName);
+					if (m->font.Italic) HeaderPrintf("\\i");
+					if (m->font.Weight > 500) HeaderPrintf("\\b");
+					if (m->font.Underline) HeaderPrintf("\\ul");
+					if (m->font.StrikeOut) HeaderPrintf("\\strike");
+					if (m->font.DoubleUnderline) HeaderPrintf("\\uldb");
+					if (m->font.SmallCaps) HeaderPrintf("\\scaps");
+					if (m->font.expndtw) HeaderPrintf("\\expndtw%d", m->font.expndtw);
+					if (m->font.up > 0) HeaderPrintf("\\up%d", m->font.up);
+					else if (m->font.up < 0) HeaderPrintf("\\dn%d", -m->font.up);
+					HeaderPrintf("\\fs%d", -2 * m->font.Height);
+					if (m->font.FGRGB[0]) HeaderPrintf("\\cf%d", m->font.FGRGB[0]);
+					if (m->font.BGRGB[0]) HeaderPrintf("\\cb%d", m->font.BGRGB[0]);
 				}
-				fprintf(rtf, " %s;}\n", m->StyleName);
+				HeaderPrintf(" %s;}\n", m->StyleName);
 			}
 			free(mvbstyle);
 		}
@@ -2354,43 +2820,42 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 				NEWSTYLE* m, * n;
 
 				m = newstyle + i;
-				fprintf(rtf, "{\\*\\cs%u \\additive", m->StyleNum + 9);
+				HeaderPrintf("{\\*\\cs%u \\additive", m->StyleNum + 9);
 				if (m->BasedOn)
 				{
 					n = newstyle + (m->BasedOn - 1);
-					if (m->font.FontName != n->font.FontName) fprintf(rtf, "\\f%d", m->font.FontName);
-					if (m->font.FGRGB[0] != n->font.FGRGB[0]) fprintf(rtf, "\\cf%d", m->font.FGRGB[0]);
-					if (m->font.BGRGB[0] != n->font.BGRGB[0]) fprintf(rtf, "\\cb%d", m->font.BGRGB[0]);
-					if (m->font.Height != n->font.Height) fprintf(rtf, "\\fs%ld", -2L * m->font.Height);
-					if ((m->font.Weight > 500) != (n->font.Weight > 500)) fprintf(rtf, "\\b%d", m->font.Weight > 500);
-					if (m->font.Italic != n->font.Italic) fprintf(rtf, "\\i%d", m->font.Italic);
-					if (m->font.Underline != n->font.Underline) fprintf(rtf, "\\ul%d", m->font.Underline);
-					if (m->font.StrikeOut != n->font.StrikeOut) fprintf(rtf, "\\strike%d", m->font.StrikeOut);
-					if (m->font.DoubleUnderline != n->font.DoubleUnderline) fprintf(rtf, "\\uldb%d", m->font.DoubleUnderline);
-					if (m->font.SmallCaps != n->font.SmallCaps) fprintf(rtf, "\\scaps%d", m->font.SmallCaps);
-					fprintf(rtf, " \\sbasedon%u", m->BasedOn + 9);
+					if (m->font.FontName != n->font.FontName) HeaderPrintf("\\f%d", m->font.FontName);
+					if (m->font.FGRGB[0] != n->font.FGRGB[0]) HeaderPrintf("\\cf%d", m->font.FGRGB[0]);
+					if (m->font.BGRGB[0] != n->font.BGRGB[0]) HeaderPrintf("\\cb%d", m->font.BGRGB[0]);
+					if (m->font.Height != n->font.Height) HeaderPrintf("\\fs%ld", -2L * m->font.Height);
+					if ((m->font.Weight > 500) != (n->font.Weight > 500)) HeaderPrintf("\\b%d", m->font.Weight > 500);
+					if (m->font.Italic != n->font.Italic) HeaderPrintf("\\i%d", m->font.Italic);
+					if (m->font.Underline != n->font.Underline) HeaderPrintf("\\ul%d", m->font.Underline);
+					if (m->font.StrikeOut != n->font.StrikeOut) HeaderPrintf("\\strike%d", m->font.StrikeOut);
+					if (m->font.DoubleUnderline != n->font.DoubleUnderline) HeaderPrintf("\\uldb%d", m->font.DoubleUnderline);
+					if (m->font.SmallCaps != n->font.SmallCaps) HeaderPrintf("\\scaps%d", m->font.SmallCaps);
+					HeaderPrintf(" \\sbasedon%u", m->BasedOn + 9);
 				}
 				else
 				{
-					fprintf(rtf, "\\f%d", m->font.FontName);
-					if (m->font.Italic) fputs("\\i", rtf);
-					if (m->font.Weight > 500) fputs("\\b", rtf);
-					if (m->font.Underline) fputs("\\ul", rtf);
-					if (m->font.StrikeOut) fputs("\\strike", rtf);
-					if (m->font.DoubleUnderline) fputs("\\uldb", rtf);
-					if (m->font.SmallCaps) fputs("\\scaps", rtf);
-					fprintf(rtf, "\\fs%d", -2 * m->font.Height);
-					if (m->font.FGRGB[0]) fprintf(rtf, "\\cf%d", m->font.FGRGB[0]);
-					if (m->font.BGRGB[0]) fprintf(rtf, "\\cb%d", m->font.BGRGB[0]);
+					HeaderPrintf("\\f%d", m->font.FontName);
+					if (m->font.Italic) HeaderPrintf("\\i");
+					if (m->font.Weight > 500) HeaderPrintf("\\b");
+					if (m->font.Underline) HeaderPrintf("\\ul");
+					if (m->font.StrikeOut) HeaderPrintf("\\strike");
+					if (m->font.DoubleUnderline) HeaderPrintf("\\uldb");
+					if (m->font.SmallCaps) HeaderPrintf("\\scaps");
+					HeaderPrintf("\\fs%d", -2 * m->font.Height);
+					if (m->font.FGRGB[0]) HeaderPrintf("\\cf%d", m->font.FGRGB[0]);
+					if (m->font.BGRGB[0]) HeaderPrintf("\\cb%d", m->font.BGRGB[0]);
 				}
-				fprintf(rtf, " %s;}\n", m->StyleName);
+				HeaderPrintf(" %s;}\n", m->StyleName);
 			}
 			free(newstyle);
 		}
 		if (family) free(family);
-		fputs("}\\pard\\plain\n", rtf);
-		memset(&CurrentFont, 0, sizeof(CurrentFont));
-		CurrentFont.FontName = DefFont;
+		HeaderPrintf("}\\pard\\plain\n");
+		FontHeader(rtf);
 		if (hpj)
 		{
 			fprintf(stderr, "%u font names, %u font descriptors", fontnames, FontHdr.NumDescriptors);
@@ -2402,16 +2867,18 @@ void FontLoad(FILE* HelpFile, FILE* rtf, FILE* hpj)
 
 /* read NumBytes from |TOPIC starting at TopicPos (or if TopicPos is 0
 // where last left off) into dest, returning number of bytes read.
-// TopicRead handles LZ77 decompression and the crossing of topic blocks */
+// TopicRead handles LZ77 decompression and the crossing of topic blocks.
+// If dest is NULL, the bytes are skipped */
+static TOPICBLOCKHEADER TopicBlockHeader;
+static unsigned char TopicBuffer[0x4000]; /* current topic block, decompressed */
+static long TopicFileStart;
+static long TopicBlockNum;
+static unsigned int DecompSize;
+static long LastTopicPos;
+
 long TopicRead(FILE* HelpFile, long TopicPos, void* dest, long NumBytes)
 {
-	static TOPICBLOCKHEADER TopicBlockHeader;
-	static unsigned char TopicBuffer[0x4000];
-	static long TopicFileStart;
-	static long TopicBlockNum;
 	unsigned int TopicBlockOffset;
-	static unsigned int DecompSize;
-	static long LastTopicPos;
 	unsigned int n;
 
 	if (!TopicFileStart) /* first call: HelpFile is at start of |TOPIC */
@@ -2445,65 +2912,97 @@ long TopicRead(FILE* HelpFile, long TopicPos, void* dest, long NumBytes)
 	if (TopicBlockOffset + NumBytes > DecompSize) /* more than available in this block */
 	{
 		n = DecompSize - TopicBlockOffset;
-		if (n) memcpy(dest, TopicBuffer + TopicBlockOffset, n);
-		return n + TopicRead(HelpFile, (TopicBlockNum + 1) * DecompressSize + sizeof(TOPICBLOCKHEADER), (char*)dest + n, NumBytes - n);
+		if (n && dest) memcpy(dest, TopicBuffer + TopicBlockOffset, n);
+		return n + TopicRead(HelpFile, (TopicBlockNum + 1) * DecompressSize + sizeof(TOPICBLOCKHEADER), dest ? (char*)dest + n : NULL, NumBytes - n);
 	}
-	if (NumBytes) memcpy(dest, TopicBuffer + TopicBlockOffset, NumBytes);
+	if (NumBytes && dest) memcpy(dest, TopicBuffer + TopicBlockOffset, NumBytes);
 	LastTopicPos = TopicPos + NumBytes;
 	return NumBytes;
 }
 
-/* Hall or oldstyle Phrase replacement of str into out */
-char* PhraseReplace(unsigned char* str, long len, char* out)
+/* like TopicRead, but returns a pointer to the NumBytes read instead of
+// copying them. If the next Keep (>= NumBytes) bytes lie within the current
+// topic block, the pointer refers to TopicRead's block buffer and stays valid
+// as long as no read goes beyond those Keep bytes. Otherwise the bytes are
+// assembled in LinkArena. Returns NULL if less than NumBytes are available */
+char* TopicView(FILE* HelpFile, long TopicPos, long NumBytes, long Keep)
+{
+	unsigned int TopicBlockOffset;
+	char* ptr;
+
+	if (Keep < NumBytes) Keep = NumBytes;
+	TopicRead(HelpFile, TopicPos, NULL, 0L); /* load block and set LastTopicPos */
+	TopicBlockOffset = (LastTopicPos - sizeof(TOPICBLOCKHEADER)) % DecompressSize;
+	if ((LastTopicPos - sizeof(TOPICBLOCKHEADER)) / DecompressSize == TopicBlockNum && TopicBlockOffset + Keep <= DecompSize)
+	{
+		LastTopicPos += NumBytes;
+		return (char*)TopicBuffer + TopicBlockOffset;
+	}
+	ptr = ArenaAlloc(&LinkArena, NumBytes);
+	if (TopicRead(HelpFile, 0L, ptr, NumBytes) != NumBytes) return NULL;
+	return ptr;
+}
+
+/* copy phrase PhraseNum to out using PhraseSpan. Phrases are padded, so
+// short ones are moved by a fixed size copy if out has room up to end */
+char* CopyPhrase(unsigned int PhraseNum, char* out, char* end)
+{
+	PHRASESPAN* span;
+
+	if (stats) Stats.Phrases++;
+	if (PhraseNum >= PhraseCount) return PrintPhrase(PhraseNum, out, NULL);
+	span = PhraseSpan + PhraseNum;
+	if (span->len <= PHRASEPAD && end - out >= PHRASEPAD)
+	{
+		memcpy(out, span->ptr, PHRASEPAD);
+	}
+	else
+	{
+		memcpy(out, span->ptr, span->len);
+	}
+	return out + span->len;
+}
+
+/* Hall or oldstyle Phrase replacement of str into out, end limits the
+// room available for fixed size copies */
+char* PhraseReplace(unsigned char* str, long len, char* out, char* end)
 {
 	int CurChar;
 
 	if (Hall)
 	{
-		while (len)
+		while (len > 0)
 		{
 			CurChar = *str++;
 			len--;
-			if ((CurChar & 1) == 0) /* phrases 0..127 */
-			{
-				out = PrintPhrase(CurChar / 2, out, NULL);
-			}
-			else if ((CurChar & 3) == 1) /* phrases 128..16511 */
+			switch (HallOp[CurChar])
 			{
-				CurChar = 128 + (CurChar / 4) * 256 + *str++;
+			case HALL_PHRASE:
+				out = CopyPhrase(HallArg[CurChar], out, end);
+				break;
+			case HALL_LONGPHRASE:
+				out = CopyPhrase(128 + HallArg[CurChar] * 256 + *str++, out, end);
 				len--;
-				out = PrintPhrase(CurChar, out, NULL);
-			}
-			else if ((CurChar & 7) == 3) /* copy next n characters */
-			{
-				while (CurChar > 0)
-				{
-					*out++ = *str++;
-					len--;
-					CurChar -= 8;
-				}
-			}
-			else if ((CurChar & 0x0F) == 0x07)
-			{
-				while (CurChar > 0)
-				{
-					*out++ = ' ';
-					CurChar -= 16;
-				}
-			}
-			else /* if((CurChar&0x0F)==0x0F) */
-			{
-				while (CurChar > 0)
-				{
-					*out++ = '\0';
-					CurChar -= 16;
-				}
+				break;
+			case HALL_COPY:
+				memcpy(out, str, HallArg[CurChar]);
+				out += HallArg[CurChar];
+				str += HallArg[CurChar];
+				len -= HallArg[CurChar];
+				break;
+			case HALL_SPACES:
+				memset(out, ' ', HallArg[CurChar]);
+				out += HallArg[CurChar];
+				break;
+			default:
+				memset(out, '\0', HallArg[CurChar]);
+				out += HallArg[CurChar];
 			}
 		}
 	}
 	else
 	{
-		while (len)
+		while (len > 0)
 		{
 			CurChar = *str++;
 			len--;
@@ -2511,7 +3010,7 @@ char* PhraseReplace(unsigned char* str, long len, char* out)
 			{
 				CurChar = 256 * (CurChar - 1) + *str++;
 				len--;
-				out = PrintPhrase(CurChar / 2, out, NULL);
+				out = CopyPhrase(CurChar / 2, out, end);
 				if (CurChar & 1) *out++ = ' ';
 			}
 			else
@@ -2526,7 +3025,8 @@ char* PhraseReplace(unsigned char* str, long len, char* out)
 /* reads next chunk from |TOPIC like TopicRead, but does phrase decompression
 // if Length > NumBytes, suitable to read LinkData2. If phrase decompression
 // doesn't expands to Length bytes, buffer is padded using 0. TopicPhraseRead
-// always NUL-terminates at dest[Length] just to be save */
+// always NUL-terminates at dest[Length] just to be save. The compressed
+// bytes are decoded in place using TopicView */
 long TopicPhraseRead(FILE* HelpFile, long TopicPos, char* dest, long NumBytes, long Length)
 {
 	char* buffer;
@@ -2539,59 +3039,138 @@ long TopicPhraseRead(FILE* HelpFile, long TopicPos, char* dest, long NumBytes, l
 		for (i = BytesRead; i <= Length; i++) dest[i] = '\0';
 		if (BytesRead == Length && Length < NumBytes) /* some trailing bytes are not used (bug in HCRTF ?) */
 		{
-			buffer = my_malloc(NumBytes - Length);
-			BytesRead += TopicRead(HelpFile, 0L, buffer, NumBytes - Length);
-			free(buffer);
+			BytesRead += TopicRead(HelpFile, 0L, NULL, NumBytes - Length);
 		}
 	}
 	else
 	{
-		buffer = my_malloc(NumBytes);
-		BytesRead = TopicRead(HelpFile, TopicPos, buffer, NumBytes);
-		NumBytes = PhraseReplace((unsigned char*)buffer, NumBytes, dest) - dest;
-		free(buffer);
+		if (PhraseFile) /* first phrase compressed text, see PhraseDefer */
+		{
+			PhraseFile = NULL;
+			PhraseLoad(HelpFile);
+		}
+		buffer = TopicView(HelpFile, TopicPos, NumBytes, NumBytes);
+		if (!buffer) return 0L;
+		BytesRead = NumBytes;
+		NumBytes = PhraseReplace((unsigned char*)buffer, NumBytes, dest, dest + Length + 1) - dest;
 		if (NumBytes > Length)
 		{
 			error("Phrase replacement delivers %ld bytes instead of %ld", NumBytes, Length);
-			exit(1);
+			quit(1);
 		}
 	}
 	while (NumBytes <= Length) dest[NumBytes++] = '\0';
 	return BytesRead;
 }
 
-void Annotate(long pos, FILE* rtf)
+int AnnoRecCmp(const void* a, const void* b)
 {
-	long FileLength;
-	char FileName[19];
-	int i;
-	long l;
+	if (((const ANNOREC*)a)->pos < ((const ANNOREC*)b)->pos) return -1;
+	if (((const ANNOREC*)a)->pos > ((const ANNOREC*)b)->pos) return 1;
+	return 0;
+}
+
+/* read the directory of AnnoFile once, noting where the annotation of
+// each topic position ("pos!0") is stored */
+void AnnoLoad(void)
+{
+	BUFFER buf;
+	char FileName[NAME_MAX];
+	char check[NAME_MAX];
+	long offset, pos;
+	int i, n, d;
 
-	sprintf(FileName, "%ld!0", pos);
-	if (SearchFile(AnnoFile, FileName, &FileLength))
+	annorecs = 0;
+	annorec = my_malloc(sizeof(ANNOREC));
+	if (!SearchFile(AnnoFile, NULL, NULL)) return;
+	for (n = GetFirstPage(AnnoFile, &buf, NULL); n; n = GetNextPage(AnnoFile, &buf))
 	{
-		fputs("{\\v {\\*\\atnid ANN}\\chatn {\\*\\annotation \\pard\\plain {\\chatn }", rtf);
-		for (l = 0; l < FileLength && (i = getc(AnnoFile)) != -1; l++)
+		for (i = 0; i < n; i++)
 		{
-			if (i == 0x0D)
-			{
-				fputs("\\par\n", rtf);
-			}
-			else if (i != '{' && i != '}' && i != '\\' && isprint(i))
-			{
-				putc(i, rtf);
-			}
-			else if (i == '{')
+			my_gets(FileName, sizeof(FileName), AnnoFile);
+			offset = getdw(AnnoFile);
+			if (sscanf(FileName, "%ld!%d", &pos, &d) == 2 && d == 0)
 			{
-				fputs("\\{\\-", rtf);
+				sprintf(check, "%ld!0", pos);
+				if (strcmp(check, FileName) == 0) /* as Annotate used to search it */
+				{
+					annorec = my_realloc(annorec, (annorecs + 1) * sizeof(ANNOREC));
+					annorec[annorecs].pos = pos;
+					annorec[annorecs].offset = offset;
+					annorecs++;
+				}
 			}
-			else if (i != '\0' && i != 0x0A)
+		}
+	}
+	qsort(annorec, annorecs, sizeof(ANNOREC), AnnoRecCmp);
+}
+
+void Annotate(long pos, FILE* rtf)
+{
+	static char* escape[256];
+	static char* text;
+	static long textsize;
+	FILEHEADER FileHdr;
+	ANNOREC key;
+	ANNOREC* rec;
+	char* out;
+	char* ptr;
+	long FileLength, l;
+	size_t bytes;
+	int i;
+
+	if (!annorec) AnnoLoad();
+	key.pos = pos;
+	rec = bsearch(&key, annorec, annorecs, sizeof(ANNOREC), AnnoRecCmp);
+	if (!rec) return;
+	if (!escape['A'])
+	{
+		for (i = 0; i < 256; i++)
+		{
+			if (i == 0x0D)
+			{
+				escape[i] = "\\par\n";
+			}
+			else if (i != '{' && i != '}' && i != '\\' && isprint(i))
+			{
+				escape[i] = my_malloc(2);
+				escape[i][0] = i;
+				escape[i][1] = '\0';
+			}
+			else if (i == '{')
+			{
+				escape[i] = "\\{\\-";
+			}
+			else if (i != '\0' && i != 0x0A)
+			{
+				escape[i] = my_malloc(5);
+				sprintf(escape[i], "\\'%02x", i);
+			}
+			else
 			{
-				fprintf(rtf, "\\'%02x", i);
+				escape[i] = "";
 			}
 		}
-		fputs("}}", rtf);
 	}
+	fseek(AnnoFile, rec->offset, SEEK_SET);
+	read_FILEHEADER(&FileHdr, AnnoFile);
+	FileLength = FileHdr.UsedSpace;
+	/* room for the annotation and its worst case expansion to \'xx */
+	if (FileLength < 0) FileLength = 0;
+	if (FileLength * 6 + 1 > textsize)
+	{
+		textsize = FileLength * 6 + 1;
+		text = my_realloc(text, textsize);
+	}
+	bytes = fread(text, 1, (size_t)FileLength, AnnoFile);
+	out = text + FileLength;
+	for (l = 0; l < (long)bytes; l++)
+	{
+		for (ptr = escape[(unsigned char)text[l]]; *ptr; ptr++) *out++ = *ptr;
+	}
+	fputs("{\\v {\\*\\atnid ANN}\\chatn {\\*\\annotation \\pard\\plain {\\chatn }", rtf);
+	fwrite(text + FileLength, out - (text + FileLength), 1, rtf);
+	fputs("}}", rtf);
 }
 
 /* collect all keywords assigned to positions starting at NextKeywordOffset
@@ -2603,7 +3182,7 @@ void CollectKeywords(FILE* HelpFile)
 	uint16_t j, m;
 	int i, n, k, l, map;
 	long FileLength, savepos, KWDataOffset, from;
-	long* keytopic;
+	int32_t* keytopic;
 	BUFFER buf;
 	char kwdata[10];
 	char kwbtree[10];
@@ -2738,8 +3317,6 @@ int ListWindows(FILE* HelpFile, long TopicOffset)
 	long savepos;
 	static int n, i;
 	static BUFFER buf;
-	static int VIOLAfound = -1;
-	static VIOLAREC* Viola;
 	int result;
 
 	if (VIOLAfound == 0) return -1;
@@ -2767,6 +3344,7 @@ int ListWindows(FILE* HelpFile, long TopicOffset)
 			if (i >= n)
 			{
 				free(Viola);
+				Viola = NULL;
 				n = GetNextPage(HelpFile, &buf);
 				if (n == 0)
 				{
@@ -3175,6 +3753,236 @@ TOPICOFFSET NextTopicOffset(TOPICOFFSET TopicOffset, TOPICPOS NextBlock, TOPICPO
 	return TopicOffset;
 }
 
+/* find the Topic Header of the topic containing TopicOffset, reading the
+// TOPICLINKs from the first one in the topic block TopicOffset points into,
+// so only the blocks up to this topic have to be decompressed, or from the
+// topic index if loaded. Stores position and topic offset of the header in
+// Pos and Offset for TopicDump */
+BOOL TopicStart(FILE* HelpFile, TOPICOFFSET TopicOffset, TOPICPOS* Pos, TOPICOFFSET* Offset)
+{
+	TOPICLINK TopicLink;
+	char* LinkData1;
+	char* ptr;
+	long block, CurrPos, CurrOffset;
+	long lwb, upb, mid;
+	BOOL found;
+
+	if (!SearchFile(HelpFile, "|TOPIC", &TopicFileLength)) return FALSE;
+	if (before31) /* topic offsets are positions in 3.0 help files */
+	{
+		*Pos = *Offset = TopicOffset;
+		return TRUE;
+	}
+	if (TopicIndexRecs) /* last indexed topic starting at or before TopicOffset */
+	{
+		lwb = 0L;
+		upb = TopicIndexRecs;
+		while (upb - lwb > 1L)
+		{
+			mid = (lwb + upb) / 2;
+			if (TopicIndex[mid].Offset <= TopicOffset)
+			{
+				lwb = mid;
+			}
+			else
+			{
+				upb = mid;
+			}
+		}
+		while (lwb > 0L && TopicIndex[lwb - 1].Offset == TopicIndex[lwb].Offset) lwb--;
+		if (TopicIndex[lwb].Offset > TopicOffset) return FALSE;
+		*Pos = TopicIndex[lwb].Pos;
+		*Offset = TopicIndex[lwb].Offset;
+		return TRUE;
+	}
+	found = FALSE;
+	for (block = TopicOffset / 0x8000L; block >= 0L && !found; block--) /* topic may start in earlier block */
+	{
+		TopicRead(HelpFile, block * DecompressSize + sizeof(TOPICBLOCKHEADER), NULL, 0L);
+		if (TopicBlockNum != block || TopicBlockHeader.FirstTopicLink == (TOPICPOS)-1) continue;
+		CurrPos = TopicBlockHeader.FirstTopicLink;
+		CurrOffset = block * 0x8000L;
+		while (TopicRead(HelpFile, CurrPos, &TopicLink, sizeof(TopicLink)) == sizeof(TOPICLINK))
+		{
+			if (TopicLink.NextBlock <= 0) break; /* end of |TOPIC */
+			if (TopicLink.RecordType == TL_TOPICHDR)
+			{
+				if (CurrOffset > TopicOffset || (found && *Offset == TopicOffset)) break;
+				*Pos = CurrPos;
+				*Offset = CurrOffset;
+				found = TRUE;
+			}
+			else if ((TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE) && TopicLink.DataLen1 > sizeof(TOPICLINK))
+			{
+				LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+				if (!LinkData1) break;
+				ptr = LinkData1;
+				scanlong(&ptr);
+				CurrOffset += scanword(&ptr);
+				ArenaReset(&LinkArena); /* LinkData1 */
+			}
+			if (CurrOffset > TopicOffset) break;
+			CurrOffset = NextTopicOffset(CurrOffset, TopicLink.NextBlock, CurrPos);
+			CurrPos = TopicLink.NextBlock;
+		}
+	}
+	return found;
+}
+
+/* write topic index (option -w) to filename, a compact file that lets
+// TopicStart seek to a topic without reading the topic blocks before it:
+// dword "HDX1", EntireFileSize of help file and length of |TOPIC to detect
+// a changed help file, number of topics, size of titles, per topic the
+// TOPICPOS of its header and of the next one, its TOPICOFFSET and the
+// offset of its title, followed by the titles. All dwords little endian */
+#define TOPICINDEXMAGIC 0x31584448L
+long IndexWrite(FILE* HelpFile, const char* filename)
+{
+	HELPHEADER Header;
+	TOPICLINK TopicLink;
+	TOPICINDEXREC* rec;
+	char* LinkData1;
+	char* LinkData2;
+	char* titles;
+	char* ptr;
+	long recs, titlesize, len, i;
+	long TopicPos, TopicOffset;
+	FILE* f;
+
+	fseek(HelpFile, 0L, SEEK_SET);
+	read_HELPHEADER(&Header, HelpFile);
+	if (!SearchFile(HelpFile, "|TOPIC", &TopicFileLength)) return 0L;
+	rec = NULL;
+	recs = 0L;
+	titles = NULL;
+	titlesize = 0L;
+	TopicOffset = 0L;
+	TopicPos = 12L;
+	while (TopicRead(HelpFile, TopicPos, &TopicLink, sizeof(TopicLink)) == sizeof(TOPICLINK))
+	{
+		if (before31)
+		{
+			if (TopicPos + TopicLink.NextBlock >= TopicFileLength) break;
+		}
+		else
+		{
+			if (TopicLink.NextBlock <= 0) break;
+		}
+		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
+		{
+			LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
+		}
+		else LinkData1 = NULL;
+		if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR)
+		{
+			LinkData2 = NULL;
+			if (TopicLink.DataLen1 < TopicLink.BlockSize) /* title is the first string of LinkData2 */
+			{
+				LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
+				if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
+			}
+			if (recs) rec[recs - 1].End = TopicPos;
+			/* %100 to decrease memory fragmentation */
+			if (recs % 100 == 0) rec = my_realloc(rec, (recs + 100) * sizeof(TOPICINDEXREC));
+			rec[recs].Pos = TopicPos;
+			rec[recs].End = TopicPos;
+			rec[recs].Offset = before31 ? TopicPos : TopicOffset;
+			rec[recs].Title = titlesize;
+			len = LinkData2 ? strlen(LinkData2) + 1 : 1;
+			titles = my_realloc(titles, titlesize + len);
+			memcpy(titles + titlesize, LinkData2 ? LinkData2 : "", len);
+			titlesize += len;
+			recs++;
+		}
+		else if (LinkData1 && (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE))
+		{
+			ptr = LinkData1;
+			scanlong(&ptr);
+			TopicOffset += scanword(&ptr);
+		}
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
+		if (before31)
+		{
+			TopicPos += TopicLink.NextBlock;
+		}
+		else
+		{
+			TopicOffset = NextTopicOffset(TopicOffset, TopicLink.NextBlock, TopicPos);
+			TopicPos = TopicLink.NextBlock;
+		}
+	}
+	if (recs) rec[recs - 1].End = TopicPos;
+	f = my_fopen(filename, "wb");
+	if (f)
+	{
+		putdw(TOPICINDEXMAGIC, f);
+		putdw(Header.EntireFileSize, f);
+		putdw(TopicFileLength, f);
+		putdw(recs, f);
+		putdw(titlesize, f);
+		for (i = 0; i < recs; i++)
+		{
+			putdw(rec[i].Pos, f);
+			putdw(rec[i].End, f);
+			putdw(rec[i].Offset, f);
+			putdw(rec[i].Title, f);
+		}
+		fwrite(titles, titlesize, 1, f);
+		my_fclose(f);
+	}
+	else recs = 0L;
+	if (rec) free(rec);
+	if (titles) free(titles);
+	return recs;
+}
+
+/* load topic index written by IndexWrite for this HelpFile, if any */
+BOOL IndexLoad(FILE* HelpFile, const char* filename)
+{
+	HELPHEADER Header;
+	long recs, titlesize, size, i;
+	FILE* f;
+
+	f = fopen(filename, "rb");
+	if (!f) return FALSE;
+	fseek(f, 0L, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	fseek(HelpFile, 0L, SEEK_SET);
+	read_HELPHEADER(&Header, HelpFile);
+	if (getdw(f) != TOPICINDEXMAGIC || getdw(f) != Header.EntireFileSize || !SearchFile(HelpFile, "|TOPIC", &TopicFileLength) || getdw(f) != TopicFileLength)
+	{
+		fprintf(stderr, "Topic index %s doesn't match help file, ignored.\n", filename);
+		fclose(f);
+		return FALSE;
+	}
+	recs = getdw(f);
+	titlesize = getdw(f);
+	if (size < 20L || recs < 0L || recs > (size - 20L) / 16L || titlesize < 0L || titlesize != size - 20L - 16L * recs)
+	{
+		fprintf(stderr, "Topic index %s is damaged, ignored.\n", filename);
+		fclose(f);
+		return FALSE;
+	}
+	if (TopicIndex) free(TopicIndex);
+	if (TopicIndexTitles) free(TopicIndexTitles);
+	TopicIndex = my_malloc((recs + 1) * sizeof(TOPICINDEXREC));
+	for (i = 0; i < recs; i++)
+	{
+		TopicIndex[i].Pos = getdw(f);
+		TopicIndex[i].End = getdw(f);
+		TopicIndex[i].Offset = getdw(f);
+		TopicIndex[i].Title = getdw(f);
+		if (TopicIndex[i].Title >= titlesize) TopicIndex[i].Title = 0;
+	}
+	TopicIndexTitles = my_malloc(titlesize + 1);
+	TopicIndexTitles[my_fread(TopicIndexTitles, titlesize, f)] = '\0';
+	fclose(f);
+	TopicIndexRecs = recs;
+	return TRUE;
+}
+
 /* TopicDump: converts the internal |TOPIC file to RTF format suitable for
 // recompilation inserting footnotes with information from other internal
 // files as required */
@@ -3184,7 +3992,7 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 	char* LinkData1;  /* Data associated with this link */
 	long nonscroll = -1L;
 	char* LinkData2;  /* Second set of data */
-	int fontset, i;
+	int fontset, i, n;
 	int NextContextRec;
 	uint32_t BrowseNum;
 	char* hotspot;
@@ -3201,13 +4009,15 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 	char* ptr;
 	char* cmd;
 	char* str;
-	long ActualTopicOffset, MaxTopicOffset;
+	long ActualTopicOffset, MaxTopicOffset, due;
 	TOPICHEADER30* TopicHdr30;
 	TOPICHEADER* TopicHdr;
 	long BogusTopicOffset;
+	BOOL skiptopic;
 
 	if (SearchFile(HelpFile, "|TOPIC", &TopicFileLength))
 	{
+		skiptopic = RenderTopic != 0L;
 		fontset = -1;
 		nextbitmap = 1;
 		if (browse) free(browse);
@@ -3216,8 +4026,8 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 		NextContextRec = 0;
 		ul = uldb = FALSE;
 		hotspot = NULL;
-		TopicOffset = 0L;
-		TopicPos = 12L;
+		TopicOffset = RenderPos ? RenderOffset : 0L;
+		TopicPos = RenderPos ? RenderPos : 12L;
 		TopicNum = 16;
 		TopicInRTF = 0;
 		NumberOfRTF = 1;
@@ -3233,17 +4043,35 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 			}
 			if (TopicLink.DataLen1 > sizeof(TOPICLINK))
 			{
-				LinkData1 = my_malloc(TopicLink.DataLen1 - sizeof(TOPICLINK) + 1);
-				if (TopicRead(HelpFile, 0L, LinkData1, TopicLink.DataLen1 - sizeof(TOPICLINK)) != TopicLink.DataLen1 - sizeof(TOPICLINK)) break;
+				LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+				if (!LinkData1) break;
 			}
 			else LinkData1 = NULL;
 			if (TopicLink.DataLen1 < TopicLink.BlockSize) /* read LinkData2 using phrase replacement */
 			{
-				LinkData2 = my_malloc(TopicLink.DataLen2 + 1);
+				LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
 				if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
 			}
 			else LinkData2 = NULL;
-			if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR) /* display a Topic Header record */
+			if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR && RenderTopic)
+			{
+				if (TopicNum - 15 > RenderTopic) break;
+				skiptopic = TopicNum - 15 != RenderTopic;
+			}
+			if (skiptopic) /* not the topic to render, only keep track of offsets */
+			{
+				if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR)
+				{
+					TopicNum++;
+				}
+				else if (LinkData1 && (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE))
+				{
+					ptr = LinkData1;
+					scanlong(&ptr);
+					TopicOffset += scanword(&ptr);
+				}
+			}
+			else if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR) /* display a Topic Header record */
 			{
 				if (TopicsPerRTF && ++TopicInRTF >= TopicsPerRTF)
 				{
@@ -3252,7 +4080,7 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 					BuildName(buffer, ++NumberOfRTF);
 					if (hpj) fprintf(hpj, "%s\n", buffer);
 					rtf = my_fopen(buffer, "wt");
-					FontLoad(HelpFile, rtf, NULL);
+					FontHeader(rtf);
 					TopicInRTF = 0;
 				}
 				else if (!firsttopic)
@@ -3267,7 +4095,7 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 					}
 				}
 				firsttopic = FALSE;
-				fprintf(stderr, "\rTopic %ld...", TopicNum - 15);
+				if (!RenderTopic) progress("\rTopic %ld...", TopicNum - 15);
 				if (!makertf)
 				{
 					BrowseNum = 0L;
@@ -3499,7 +4327,39 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 							{
 								if (*str != '{' && *str != '}' && *str != '\\' && isprint((unsigned char)*str))
 								{
-									putc(*str, rtf);
+									/* write a run of plain characters at once, stopping
+									// short of the next context id or keyword footnote */
+									for (n = 1; str[n] && str[n] != '{' && str[n] != '}' && str[n] != '\\' && isprint((unsigned char)str[n]); n++);
+									if (!makertf && n > 1)
+									{
+										due = 0x7FFFFFFFL;
+										if (NextContextRec < ContextRecs && ContextRec[NextContextRec].TopicOffset < MaxTopicOffset)
+										{
+											due = ContextRec[NextContextRec].TopicOffset;
+										}
+										if (!before31)
+										{
+											if (NextKeywordRec < KeywordRecs)
+											{
+												if (KeywordRec[NextKeywordRec].TopicOffset < MaxTopicOffset && KeywordRec[NextKeywordRec].TopicOffset < due)
+												{
+													due = KeywordRec[NextKeywordRec].TopicOffset;
+												}
+											}
+											else if (NextKeywordOffset != 0x7FFFFFFFL)
+											{
+												due = ActualTopicOffset + 1;
+											}
+										}
+										if (due - ActualTopicOffset < n) n = due > ActualTopicOffset ? (int)(due - ActualTopicOffset) : 1;
+									}
+									fwrite(str, n, 1, rtf);
+									if (ActualTopicOffset < MaxTopicOffset)
+									{
+										ActualTopicOffset += n - 1;
+										if (ActualTopicOffset > MaxTopicOffset) ActualTopicOffset = MaxTopicOffset;
+									}
+									str += n - 1;
 								}
 								else if (!makertf && *str == '{')
 								{
@@ -3611,6 +4471,11 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 								switch (x1)
 								{
 								case 1:
+									if (BitmapFile) /* embedded bitmaps are numbered by ExportBitmaps */
+									{
+										ExportBitmaps(BitmapFile);
+										BitmapFile = NULL;
+									}
 									while (nextbitmap < extensions && extension[nextbitmap] < 0x10) nextbitmap++;
 									if (nextbitmap >= extensions)
 									{
@@ -3816,8 +4681,7 @@ FILE* TopicDump(FILE* HelpFile, FILE* rtf, FILE* hpj, BOOL makertf)
 					}
 				}
 			}
-			if (LinkData1) free(LinkData1);
-			if (LinkData2) free(LinkData2);
+			ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
 			if (before31)
 			{
 				TopicPos += TopicLink.NextBlock;
@@ -3850,28 +4714,62 @@ void ContextLoad(FILE* HelpFile)
 		n = GetFirstPage(HelpFile, &buf, &entries);
 		if (entries)
 		{
+			if (ContextRec) free(ContextRec);
 			ContextRec = my_malloc(entries * sizeof(CONTEXTREC));
 			ContextRecs = 0;
 			while (n)
 			{
 				if (ContextRecs + n > entries) {
 					fprintf(stderr, "malformed |CONTEXT file\n");
-					exit(1);
+					quit(1);
 				}
 				read_CONTEXTRECs(ContextRec + ContextRecs, n, HelpFile);
 				ContextRecs += n;
 				n = GetNextPage(HelpFile, &buf);
 			}
-			fprintf(stderr, "%d topic offsets and hash values loaded\n", ContextRecs);
+			progress("%d topic offsets and hash values loaded\n", ContextRecs);
 			qsort(ContextRec, ContextRecs, sizeof(CONTEXTREC), ContextRecCmp);
 		}
 	}
 	else if (SearchFile(HelpFile, "|TOMAP", &entries))
 	{
+		if (Topic) free(Topic);
 		Topic = my_malloc(entries);
 		my_fread(Topic, entries, HelpFile);
 		Topics = (int)(entries / sizeof(int32_t));
+		TopicHashBuild();
+	}
+}
+
+/* topic offset of topic TopicNum (1 = first) from |CATALOG, or from |TOMAP
+// (as loaded by ContextLoad) in 3.0 help files, where it is a position.
+// Reads only the entry of this topic */
+BOOL CatalogOffset(FILE* HelpFile, long TopicNum, TOPICOFFSET* TopicOffset)
+{
+	CATALOGHEADER catalog;
+	long FileLength;
+
+	if (TopicNum < 1L) return FALSE;
+	if (before31)
+	{
+		if (Topics)
+		{
+			if (TopicNum + 15 >= Topics) return FALSE;
+			*TopicOffset = Topic[TopicNum + 15];
+			return TRUE;
+		}
+		if (!SearchFile(HelpFile, "|TOMAP", &FileLength) || (TopicNum + 16) * 4L > FileLength) return FALSE;
+		fseek(HelpFile, (TopicNum + 15) * 4L, SEEK_CUR);
 	}
+	else
+	{
+		if (!SearchFile(HelpFile, "|CATALOG", NULL)) return FALSE;
+		read_CATALOGHEADER(&catalog, HelpFile);
+		if (TopicNum > catalog.entries) return FALSE;
+		fseek(HelpFile, (TopicNum - 1) * 4L, SEEK_CUR);
+	}
+	*TopicOffset = getdw(HelpFile);
+	return TRUE;
 }
 
 void GenerateContent(FILE* HelpFile, FILE* ContentFile) /* create a simple Win95 contents file */
@@ -3929,117 +4827,482 @@ void GenerateContent(FILE* HelpFile, FILE* ContentFile) /* create a simple Win95
 	}
 }
 
-void ListRose(FILE* HelpFile, FILE* hpj)
+/* look up hash value of a context id in the |CONTEXT B+ tree, descending
+// from its root instead of loading all of it like ContextLoad */
+BOOL ContextOffset(FILE* HelpFile, int32_t hash, TOPICOFFSET* TopicOffset)
 {
-	long FileLength, offset, hash, h, pos, savepos;
-	unsigned char* ptr;
-	long* keytopic;
-	int n, i, l, e;
-	uint16_t j, count;
-	BUFFER buf, buf2;
+	BTREEHEADER BTreeHdr;
+	BTREENODEHEADER CurrNode;
+	CONTEXTREC ContextRec;
+	long offset;
+	int i, n;
 
-	if (SearchFile(HelpFile, "|Rose", NULL))
+	if (!SearchFile(HelpFile, "|CONTEXT", NULL)) return FALSE;
+	read_BTREEHEADER(&BTreeHdr, HelpFile);
+	if (!BTreeHdr.TotalBtreeEntries) return FALSE;
+	offset = ftell(HelpFile);
+	CurrNode.PreviousPage = BTreeHdr.RootPage;
+	for (n = 1; n < BTreeHdr.NLevels; n++)
 	{
-		savepos = ftell(HelpFile);
-		if (SearchFile(HelpFile, "|KWDATA", &FileLength))
+		fseek(HelpFile, offset + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
+		read_BTREEINDEXHEADER_to_BTREENODEHEADER(&CurrNode, HelpFile);
+		for (i = 0; i < CurrNode.NEntries; i++)
 		{
-			keytopic = my_malloc(FileLength);
-			my_fread(keytopic, FileLength, HelpFile);
-			if (SearchFile(HelpFile, "|KWBTREE", NULL))
-			{
-				fputs("[MACROS]\n", hpj);
-				for (n = GetFirstPage(HelpFile, &buf, NULL); n; n = GetNextPage(HelpFile, &buf))
-				{
-					for (i = 0; i < n; i++)
-					{
-						my_gets(keyword, sizeof(keyword), HelpFile);
-						for (hash = 0L, ptr = (unsigned char*)keyword; *ptr; ptr++)
-						{
-							hash = hash * 43L + table[*ptr];
-						}
-						count = my_getw(HelpFile);
-						offset = getdw(HelpFile);
-						for (j = 0; j < count; j++)
-						{
-							if (keytopic[offset / 4 + j] == -1L)
-							{
-								pos = ftell(HelpFile);
-								fseek(HelpFile, savepos, SEEK_SET);
-								for (l = GetFirstPage(HelpFile, &buf2, NULL); l; l = GetNextPage(HelpFile, &buf2))
-								{
-									for (e = 0; e < l; e++)
-									{
-										h = getdw(HelpFile);
-										my_gets(buffer, sizeof(buffer), HelpFile);
-										if (h == hash)
-										{
-											fprintf(hpj, "%s\n%s\n", keyword, buffer);
-											my_gets(buffer, sizeof(buffer), HelpFile);
-											fprintf(hpj, "%s\n", buffer);
-										}
-										else
-										{
-											my_gets(buffer, sizeof(buffer), HelpFile);
-										}
-									}
-								}
-								fseek(HelpFile, pos, SEEK_SET);
-								break;
-							}
-						}
-					}
-				}
-				putc('\n', hpj);
-			}
-			free(keytopic);
+			ContextRec.HashValue = getdw(HelpFile);
+			if (ContextRec.HashValue > hash) break;
+			CurrNode.PreviousPage = my_getw(HelpFile); /* Page */
+		}
+	}
+	fseek(HelpFile, offset + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
+	read_BTREENODEHEADER(&CurrNode, HelpFile);
+	for (i = 0; i < CurrNode.NEntries; i++)
+	{
+		read_CONTEXTREC(&ContextRec, HelpFile);
+		if (ContextRec.HashValue == hash)
+		{
+			*TopicOffset = ContextRec.TopicOffset;
+			return TRUE;
 		}
+		if (ContextRec.HashValue > hash) break;
 	}
+	return FALSE;
 }
 
-/* dump section: all the dump-routines are used to display internal files
-// of the help file with known format of contents for debugging reasons */
-void PrintNewFont(int i, NEWFONT* newfont)
+/* find topic given as context id, #hash value or +topic offset (option -j)
+// and set RenderPos and RenderOffset to let TopicDump write only this topic */
+BOOL RenderFind(FILE* HelpFile, char* id)
 {
-	printf("%3d: %-32.32s %6d %-6s %02X%02X%02X %02X%02X%02X ", i, fontname[newfont->FontName], newfont->Height, FontFamily(newfont->PitchAndFamily >> 4), newfont->FGRGB[2], newfont->FGRGB[1], newfont->FGRGB[0], newfont->BGRGB[2], newfont->BGRGB[1], newfont->BGRGB[0]);
-	if (newfont->Weight > 500) putchar('b');
-	if (newfont->Italic) putchar('i');
-	if (newfont->Underline) putchar('u');
-	if (newfont->StrikeOut) putchar('s');
-	if (newfont->DoubleUnderline) putchar('d');
-	if (newfont->SmallCaps) putchar('c');
-	putchar('\n');
+	TOPICOFFSET TopicOffset;
+
+	if (id[0] == '+')
+	{
+		TopicOffset = strtoul(id + 1, NULL, 0);
+	}
+	else if (!ContextOffset(HelpFile, id[0] == '#' ? (int32_t)strtoul(id + 1, NULL, 0) : hash(id), &TopicOffset))
+	{
+		return FALSE;
+	}
+	if (!TopicStart(HelpFile, TopicOffset, &RenderPos, &RenderOffset)) return FALSE;
+	RenderTopic = 1L;
+	return TRUE;
 }
 
-void PrintMvbFont(int i, MVBFONT* mvbfont)
+/* compare keyword with prefix ignoring case, 0 if keyword starts with it */
+int KeywordCmp(const char* keyword, const char* prefix)
 {
-	printf("%3d: %-32.32s %6d %-6s %02X%02X%02X %02X%02X%02X ", i, fontname[mvbfont->FontName], mvbfont->Height, FontFamily(mvbfont->PitchAndFamily >> 4), mvbfont->FGRGB[2], mvbfont->FGRGB[1], mvbfont->FGRGB[0], mvbfont->BGRGB[2], mvbfont->BGRGB[1], mvbfont->BGRGB[0]);
-	if (mvbfont->Weight > 500) putchar('b');
-	if (mvbfont->Italic) putchar('i');
-	if (mvbfont->Underline) putchar('u');
-	if (mvbfont->StrikeOut) putchar('s');
-	if (mvbfont->DoubleUnderline) putchar('d');
-	if (mvbfont->SmallCaps) putchar('c');
-	putchar('\n');
+	while (*prefix && tolower((unsigned char)*keyword) == tolower((unsigned char)*prefix))
+	{
+		keyword++;
+		prefix++;
+	}
+	return *prefix ? tolower((unsigned char)*keyword) - tolower((unsigned char)*prefix) : 0;
 }
 
-void FontDump(FILE* HelpFile)
+/* call proc for the keywords of keyword list (K, A or other footnote
+// character) starting with prefix, or if prefix is NULL for the keywords
+// from the nth one (0 = first) on, until proc returns 0. Only the pages of
+// |xWBTREE holding these keywords are read, found by descending its index
+// pages for a prefix and through the leaf page map |xWMAP for the nth
+// keyword, and only their topic offsets are read from |xWDATA. Returns
+// number of keywords passed to proc */
+long KeywordLookup(FILE* HelpFile, int list, const char* prefix, long n, HELPDECOKEYWORDPROC proc, void* ctx)
 {
-	FONTHEADER FontHdr;
-	long FileStart;
-	OLDFONT oldfont;
-	NEWFONT newfont;
-	NEWSTYLE newstyle;
-	MVBFONT mvbfont;
-	MVBSTYLE mvbstyle;
-	int i, n;
+	BTREEHEADER BTreeHdr;
+	BTREENODEHEADER CurrNode;
+	KWMAPREC* map;
+	char name[10];
+	long offset, kwdata, kwdatalength, keywordnum, found, savepos, pos;
+	long* topic;
+	int i, j, maps, page, cmp;
+	uint16_t count;
+	BOOL more;
 
-	/* Go to the FONT file and get the headers */
+	sprintf(name, "|%cWDATA", list);
+	if (!SearchFile(HelpFile, name, &kwdatalength)) return 0L;
+	kwdata = ftell(HelpFile);
+	map = NULL;
+	maps = 0;
+	sprintf(name, "|%cWMAP", list);
+	if (SearchFile(HelpFile, name, NULL))
+	{
+		maps = my_getw(HelpFile);
+		map = my_malloc((maps + 1) * sizeof(KWMAPREC));
+		for (i = 0; i < maps; i++) read_KWMAPREC(map + i, HelpFile);
+	}
+	sprintf(name, "|%cWBTREE", list);
+	if (!SearchFile(HelpFile, name, NULL))
+	{
+		if (map) free(map);
+		return 0L;
+	}
+	read_BTREEHEADER(&BTreeHdr, HelpFile);
+	offset = ftell(HelpFile);
+	page = BTreeHdr.RootPage;
+	keywordnum = -1L; /* unknown */
+	if (prefix || !maps) /* descend to leftmost leaf page that may hold prefix */
+	{
+		for (j = 1; j < BTreeHdr.NLevels; j++)
+		{
+			fseek(HelpFile, offset + page * (long)BTreeHdr.PageSize, SEEK_SET);
+			read_BTREEINDEXHEADER_to_BTREENODEHEADER(&CurrNode, HelpFile);
+			page = CurrNode.PreviousPage;
+			for (i = 0; prefix && i < CurrNode.NEntries; i++)
+			{
+				my_gets(keyword, sizeof(keyword), HelpFile);
+				if (KeywordCmp(keyword, prefix) >= 0) break;
+				page = my_getw(HelpFile);
+			}
+		}
+		for (i = 0; i < maps; i++)
+		{
+			if (map[i].PageNum == page)
+			{
+				keywordnum = map[i].FirstRec;
+				break;
+			}
+		}
+		if (!prefix) keywordnum = 0L;
+	}
+	else /* last leaf page starting at or before keyword n */
+	{
+		for (i = 1; i < maps && map[i].FirstRec <= n; i++);
+		page = map[i - 1].PageNum;
+		keywordnum = map[i - 1].FirstRec;
+	}
+	if (map) free(map);
+	topic = NULL;
+	found = 0L;
+	more = BTreeHdr.TotalBtreeEntries > 0;
+	while (more && page != -1)
+	{
+		fseek(HelpFile, offset + page * (long)BTreeHdr.PageSize, SEEK_SET);
+		read_BTREENODEHEADER(&CurrNode, HelpFile);
+		for (i = 0; more && i < CurrNode.NEntries; i++)
+		{
+			my_gets(keyword, sizeof(keyword), HelpFile);
+			count = my_getw(HelpFile);
+			pos = getdw(HelpFile);
+			if (keywordnum != -1L) keywordnum++;
+			if (prefix)
+			{
+				cmp = KeywordCmp(keyword, prefix);
+				if (cmp < 0) continue;
+				if (cmp > 0) break;
+			}
+			else if (keywordnum - 1 < n)
+			{
+				continue;
+			}
+			if (pos < 0 || pos + 4L * count > kwdatalength) count = 0;
+			topic = my_realloc(topic, (count + 1) * sizeof(long));
+			savepos = ftell(HelpFile);
+			fseek(HelpFile, kwdata + pos, SEEK_SET);
+			for (j = 0; j < count; j++) topic[j] = (int32_t)getdw(HelpFile);
+			found++;
+			more = proc(ctx, keywordnum == -1L ? -1L : keywordnum - 1, keyword, count, topic) != 0;
+			fseek(HelpFile, savepos, SEEK_SET); /* proc may look up titles */
+		}
+		if (i < CurrNode.NEntries) break;
+		page = CurrNode.NextPage;
+	}
+	if (topic) free(topic);
+	return found;
+}
+
+/* title of topic containing TopicOffset from topic index (option -w),
+// NULL if no topic index is loaded */
+char* IndexTitle(TOPICOFFSET TopicOffset)
+{
+	long i, j, k;
+
+	i = 0L;
+	j = TopicIndexRecs;
+	while (i < j)
+	{
+		k = (i + j) / 2;
+		if (TopicIndex[k].Offset <= TopicOffset)
+		{
+			i = k + 1;
+		}
+		else
+		{
+			j = k;
+		}
+	}
+	return i ? TopicIndexTitles + TopicIndex[i - 1].Title : NULL;
+}
+
+/* descend the |TTLBTREE B+ tree (HelpFile positioned at its start) to the
+// leaf page holding the title of the topic containing TopicOffset, like
+// GetFirstPage does to the first one, so GetNextPage may continue from
+// there. Returns number of entries of this page */
+int16_t TitlePage(FILE* HelpFile, TOPICOFFSET TopicOffset, BUFFER* buf)
+{
+	BTREEHEADER BTreeHdr;
+	BTREENODEHEADER CurrNode;
+	int i, n;
+
+	read_BTREEHEADER(&BTreeHdr, HelpFile);
+	if (!BTreeHdr.TotalBtreeEntries) return 0;
+	buf->FirstLeaf = ftell(HelpFile);
+	buf->PageSize = BTreeHdr.PageSize;
+	CurrNode.PreviousPage = BTreeHdr.RootPage;
+	for (n = 1; n < BTreeHdr.NLevels; n++)
+	{
+		fseek(HelpFile, buf->FirstLeaf + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
+		read_BTREEINDEXHEADER_to_BTREENODEHEADER(&CurrNode, HelpFile);
+		for (i = 0; i < CurrNode.NEntries; i++)
+		{
+			if (getdw(HelpFile) > TopicOffset) break;
+			CurrNode.PreviousPage = my_getw(HelpFile); /* Page */
+		}
+	}
+	fseek(HelpFile, buf->FirstLeaf + CurrNode.PreviousPage * (long)BTreeHdr.PageSize, SEEK_SET);
+	read_BTREENODEHEADER(&CurrNode, HelpFile);
+	buf->NextPage = CurrNode.NextPage;
+	return CurrNode.NEntries;
+}
+
+/* load all titles of |TTLBTREE into TitleRec for repeated TitleLookup */
+long TitleLoad(FILE* HelpFile)
+{
+	BUFFER buf;
+	long size, len;
+	int i, n;
+
+	if (TitleRecs || !SearchFile(HelpFile, "|TTLBTREE", NULL)) return TitleRecs;
+	size = 0L;
+	for (n = GetFirstPage(HelpFile, &buf, NULL); n; n = GetNextPage(HelpFile, &buf))
+	{
+		for (i = 0; i < n; i++)
+		{
+			/* %100 to decrease memory fragmentation */
+			if (TitleRecs % 100 == 0) TitleRec = my_realloc(TitleRec, (TitleRecs + 100) * sizeof(TITLEREC));
+			TitleRec[TitleRecs].TopicOffset = getdw(HelpFile);
+			my_gets(buffer, sizeof(buffer), HelpFile);
+			len = strlen(buffer) + 1;
+			TitleStrings = my_realloc(TitleStrings, size + len);
+			memcpy(TitleStrings + size, buffer, len);
+			TitleRec[TitleRecs++].Title = size;
+			size += len;
+		}
+	}
+	return TitleRecs;
+}
+
+/* title of the topic containing TopicOffset, taken from the titles loaded
+// by TitleLoad or by descending |TTLBTREE, or from the topic index if
+// there is no |TTLBTREE. Returns NULL if not found */
+char* TitleLookup(FILE* HelpFile, TOPICOFFSET TopicOffset)
+{
+	static char title[512];
+	BUFFER buf;
+	long i, j, k;
+	BOOL found;
+
+	if (TitleRecs)
+	{
+		i = 0L;
+		j = TitleRecs;
+		while (i < j)
+		{
+			k = (i + j) / 2;
+			if (TitleRec[k].TopicOffset <= TopicOffset)
+			{
+				i = k + 1;
+			}
+			else
+			{
+				j = k;
+			}
+		}
+		return i ? TitleStrings + TitleRec[i - 1].Title : NULL;
+	}
+	if (!SearchFile(HelpFile, "|TTLBTREE", NULL)) return IndexTitle(TopicOffset);
+	found = FALSE;
+	for (i = TitlePage(HelpFile, TopicOffset, &buf); i > 0; i--)
+	{
+		if (getdw(HelpFile) > TopicOffset) break;
+		my_gets(title, sizeof(title), HelpFile);
+		found = TRUE;
+	}
+	return found ? title : NULL;
+}
+
+/* dump |TTLBTREE (HelpFile positioned at its start) like BTreeDump, but
+// starting at the title of the topic containing TopicOffset */
+void TitleDump(FILE* HelpFile, TOPICOFFSET TopicOffset)
+{
+	BUFFER buf;
+	long pos;
+	int i, n, skip;
+	TOPICOFFSET Offset;
+
+	n = TitlePage(HelpFile, TopicOffset, &buf);
+	pos = ftell(HelpFile);
+	for (skip = 0; skip < n; skip++)
+	{
+		if (getdw(HelpFile) > TopicOffset) break;
+		my_gets(buffer, sizeof(buffer), HelpFile);
+	}
+	fseek(HelpFile, pos, SEEK_SET);
+	for (i = 1; i < skip; i++)
+	{
+		getdw(HelpFile);
+		my_gets(buffer, sizeof(buffer), HelpFile);
+	}
+	for (i = skip ? skip - 1 : 0; n; n = GetNextPage(HelpFile, &buf), i = 0)
+	{
+		for (; i < n; i++)
+		{
+			Offset = getdw(HelpFile);
+			my_gets(buffer, sizeof(buffer), HelpFile);
+			printf("TopicOffset: 0x%08lx TopicTitle: %s\n", (unsigned long)Offset, buffer);
+		}
+	}
+}
+
+/* write keyword and topic offsets of its topics (option -k) with their
+// titles. Stops after first one if ctx set */
+int KeywordPrint(void* ctx, long keywordnum, const char* keyword, int topics, const long* topicoffset)
+{
+	char* title;
+	int i;
+
+	if (keywordnum != -1L)
+	{
+		printf("Keyword %ld: %s\n", keywordnum, keyword);
+	}
+	else
+	{
+		printf("Keyword: %s\n", keyword);
+	}
+	for (i = 0; i < topics; i++)
+	{
+		title = TitleLookup(KeywordFile, topicoffset[i]);
+		if (title)
+		{
+			printf("  0x%08lx %s\n", topicoffset[i], title);
+		}
+		else
+		{
+			printf("  0x%08lx\n", topicoffset[i]);
+		}
+	}
+	return ctx == NULL;
+}
+
+void ListRose(FILE* HelpFile, FILE* hpj)
+{
+	long FileLength, offset, hash, h, pos, savepos;
+	unsigned char* ptr;
+	int32_t* keytopic;
+	int n, i, l, e;
+	uint16_t j, count;
+	BUFFER buf, buf2;
+
+	if (SearchFile(HelpFile, "|Rose", NULL))
+	{
+		savepos = ftell(HelpFile);
+		if (SearchFile(HelpFile, "|KWDATA", &FileLength))
+		{
+			keytopic = my_malloc(FileLength);
+			my_fread(keytopic, FileLength, HelpFile);
+			if (SearchFile(HelpFile, "|KWBTREE", NULL))
+			{
+				fputs("[MACROS]\n", hpj);
+				for (n = GetFirstPage(HelpFile, &buf, NULL); n; n = GetNextPage(HelpFile, &buf))
+				{
+					for (i = 0; i < n; i++)
+					{
+						my_gets(keyword, sizeof(keyword), HelpFile);
+						for (hash = 0L, ptr = (unsigned char*)keyword; *ptr; ptr++)
+						{
+							hash = hash * 43L + table[*ptr];
+						}
+						count = my_getw(HelpFile);
+						offset = getdw(HelpFile);
+						for (j = 0; j < count; j++)
+						{
+							if (keytopic[offset / 4 + j] == -1)
+							{
+								pos = ftell(HelpFile);
+								fseek(HelpFile, savepos, SEEK_SET);
+								for (l = GetFirstPage(HelpFile, &buf2, NULL); l; l = GetNextPage(HelpFile, &buf2))
+								{
+									for (e = 0; e < l; e++)
+									{
+										h = getdw(HelpFile);
+										my_gets(buffer, sizeof(buffer), HelpFile);
+										if (h == hash)
+										{
+											fprintf(hpj, "%s\n%s\n", keyword, buffer);
+											my_gets(buffer, sizeof(buffer), HelpFile);
+											fprintf(hpj, "%s\n", buffer);
+										}
+										else
+										{
+											my_gets(buffer, sizeof(buffer), HelpFile);
+										}
+									}
+								}
+								fseek(HelpFile, pos, SEEK_SET);
+								break;
+							}
+						}
+					}
+				}
+				putc('\n', hpj);
+			}
+			free(keytopic);
+		}
+	}
+}
+
+/* dump section: all the dump-routines are used to display internal files
+// of the help file with known format of contents for debugging reasons */
+void PrintNewFont(int i, NEWFONT* newfont)
+{
+	printf("%3d: %-32.32s %6d %-6s %02X%02X%02X %02X%02X%02X ", i, fontname[newfont->FontName], newfont->Height, FontFamily(newfont->PitchAndFamily >> 4), newfont->FGRGB[2], newfont->FGRGB[1], newfont->FGRGB[0], newfont->BGRGB[2], newfont->BGRGB[1], newfont->BGRGB[0]);
+	if (newfont->Weight > 500) putchar('b');
+	if (newfont->Italic) putchar('i');
+	if (newfont->Underline) putchar('u');
+	if (newfont->StrikeOut) putchar('s');
+	if (newfont->DoubleUnderline) putchar('d');
+	if (newfont->SmallCaps) putchar('c');
+	putchar('\n');
+}
+
+void PrintMvbFont(int i, MVBFONT* mvbfont)
+{
+	printf("%3d: %-32.32s %6d %-6s %02X%02X%02X %02X%02X%02X ", i, fontname[mvbfont->FontName], mvbfont->Height, FontFamily(mvbfont->PitchAndFamily >> 4), mvbfont->FGRGB[2], mvbfont->FGRGB[1], mvbfont->FGRGB[0], mvbfont->BGRGB[2], mvbfont->BGRGB[1], mvbfont->BGRGB[0]);
+	if (mvbfont->Weight > 500) putchar('b');
+	if (mvbfont->Italic) putchar('i');
+	if (mvbfont->Underline) putchar('u');
+	if (mvbfont->StrikeOut) putchar('s');
+	if (mvbfont->DoubleUnderline) putchar('d');
+	if (mvbfont->SmallCaps) putchar('c');
+	putchar('\n');
+}
+
+void FontDump(FILE* HelpFile)
+{
+	FONTHEADER FontHdr;
+	long FileStart;
+	OLDFONT oldfont;
+	NEWFONT newfont;
+	NEWSTYLE newstyle;
+	MVBFONT mvbfont;
+	MVBSTYLE mvbstyle;
+	int i, n;
+
+	/* Go to the FONT file and get the headers */
 	FileStart = ftell(HelpFile);
 	read_FONTHEADER(&FontHdr, HelpFile);
 	if (FontHdr.DescriptorsOffset < FontHdr.FacenamesOffset)
 	{
 		fprintf(stderr, "malformed FONT file\n");
-		exit(1);
+		quit(1);
 	}
 	if (FontHdr.NumFacenames)
 	{
@@ -4144,64 +5407,161 @@ void PhrImageDump(FILE* HelpFile)
 	}
 }
 
+/* BTreeDump compiles its printf-like text once into a list of BTREEFIELD
+// and formats all entries into dumpout, which is written in large blocks */
+static char dumpout[0x4000];
+static char* dumpptr = dumpout;
+
+static void DumpFlush(void)
+{
+	if (dumpptr > dumpout) fwrite(dumpout, dumpptr - dumpout, 1, stdout);
+	dumpptr = dumpout;
+}
+
+/* room for at least bytes in dumpout, FALSE if it will never fit */
+static BOOL DumpRoom(long bytes)
+{
+	if (dumpout + sizeof(dumpout) - dumpptr < bytes) DumpFlush();
+	return dumpout + sizeof(dumpout) - dumpptr >= bytes;
+}
+
+static void DumpText(const char* text, long len)
+{
+	if (DumpRoom(len))
+	{
+		memcpy(dumpptr, text, len);
+		dumpptr += len;
+	}
+	else
+	{
+		fwrite(text, len, 1, stdout);
+	}
+}
+
+static void DumpHex(uint32_t x, int digits, const char* hex)
+{
+	DumpRoom(digits);
+	while (digits--) *dumpptr++ = hex[(x >> (digits * 4)) & 0x0F];
+}
+
 void BTreeDump(FILE* HelpFile, char text[])
 {
-	int n, i, j;
+	int n, i, j, fields;
 	long count;
+	uint32_t dw;
 	BUFFER buf;
-	char format[10];
+	BTREEFIELD* field;
+	BTREEFIELD* f;
 	char* ptr;
 
+	/* compile text */
+	field = my_malloc((strlen(text) + 1) * sizeof(BTREEFIELD));
+	fields = 0;
+	for (ptr = text; *ptr; ptr++)
+	{
+		f = field + fields;
+		j = strcspn(ptr, "hsdiouxX!");
+		if (*ptr == '%' && ptr[j] && j + 1 < sizeof(f->format))
+		{
+			memcpy(f->format, ptr, j + 1);
+			f->format[j + 1] = '\0';
+			if (ptr[j] == '!' || ptr[j] == 'h' || ptr[j] == 's')
+			{
+				f->type = ptr[j];
+				f->format[j] = 's';
+			}
+			else
+			{
+				f->type = strchr(f->format, 'l') ? 'l' : 'w';
+			}
+			fields++;
+			ptr += j;
+		}
+		else if (fields && field[fields - 1].type == '\0' && field[fields - 1].text + field[fields - 1].len == ptr)
+		{
+			field[fields - 1].len++;
+		}
+		else
+		{
+			f->type = '\0';
+			f->text = ptr;
+			f->len = 1;
+			fields++;
+		}
+	}
+	/* dump entries */
 	n = GetFirstPage(HelpFile, &buf, NULL);
 	while (n)
 	{
 		for (i = 0; i < n; i++)
 		{
-			for (ptr = text; *ptr; ptr++)
+			for (f = field; f < field + fields; f++)
 			{
-				if (*ptr == '%')
+				switch (f->type)
 				{
-					j = strcspn(ptr, "hsdiouxX!");
-					memcpy(format, ptr, j + 1);
-					format[j + 1] = '\0';
-					if (format[j] == '!')
+				case '\0':
+					DumpText(f->text, f->len);
+					break;
+				case '!':
+					count = getdw(HelpFile);
+					while (count >= 8)
 					{
-						count = getdw(HelpFile);
-						while (count >= 8)
-						{
-							printf(" (%u)", (unsigned int)getdw(HelpFile));
-							printf("%08X", (unsigned int)getdw(HelpFile));
-							count -= 8;
-						}
+						DumpRoom(32);
+						dumpptr += sprintf(dumpptr, " (%u)", (unsigned int)getdw(HelpFile));
+						DumpHex(getdw(HelpFile), 8, "0123456789ABCDEF");
+						count -= 8;
 					}
-					else if (format[j] == 'h')
+					break;
+				case 'h':
+				case 's':
+					if (f->type == 'h')
 					{
-						format[j] = 's';
-						printf(format, unhash(getdw(HelpFile)));
+						ptr = unhash(getdw(HelpFile));
 					}
-					else if (format[j] == 's')
+					else
 					{
 						my_gets(buffer, sizeof(buffer), HelpFile);
-						printf(format, buffer);
+						ptr = buffer;
 					}
-					else if (strchr(format, 'l'))
+					if (strcmp(f->format, "%s") == 0)
 					{
-						printf(format, getdw(HelpFile));
+						DumpText(ptr, strlen(ptr));
 					}
 					else
 					{
-						printf(format, my_getw(HelpFile));
+						DumpFlush();
+						printf(f->format, ptr);
 					}
-					ptr += j;
-				}
-				else
-				{
-					putchar(*ptr);
+					break;
+				case 'l':
+					dw = getdw(HelpFile);
+					if (strcmp(f->format, "%08lx") == 0)
+					{
+						DumpHex(dw, 8, "0123456789abcdef");
+					}
+					else
+					{
+						DumpRoom(64);
+						if (strpbrk(f->format, "di"))
+						{
+							dumpptr += sprintf(dumpptr, f->format, (long)(int32_t)dw);
+						}
+						else
+						{
+							dumpptr += sprintf(dumpptr, f->format, (unsigned long)dw);
+						}
+					}
+					break;
+				default:
+					DumpRoom(64);
+					dumpptr += sprintf(dumpptr, f->format, my_getw(HelpFile));
 				}
 			}
 		}
 		n = GetNextPage(HelpFile, &buf);
 	}
+	DumpFlush();
+	free(field);
 }
 
 void PhraseDump(void)
@@ -4380,13 +5740,13 @@ void DumpTopic(FILE* HelpFile, long TopicPos)
 		printf("TopicPos=%08lX TopicOffset=%08lX PrevBlock=%08X NextBlock=%08X\n", TopicPos, TopicOffset, (unsigned int)TopicLink.PrevBlock, (unsigned int)TopicLink.NextBlock);
 		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
 		{
-			LinkData1 = my_malloc(TopicLink.DataLen1 - sizeof(TOPICLINK));
-			if (TopicRead(HelpFile, 0L, LinkData1, TopicLink.DataLen1 - sizeof(TOPICLINK)) != TopicLink.DataLen1 - sizeof(TOPICLINK)) break;
+			LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
 		}
 		else LinkData1 = NULL;
 		if (TopicLink.DataLen1 < TopicLink.BlockSize) /* read LinkData2 using phrase replacement */
 		{
-			LinkData2 = my_malloc(TopicLink.DataLen2 + 1);
+			LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
 			if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
 		}
 		else LinkData2 = NULL;
@@ -4691,8 +6051,7 @@ void DumpTopic(FILE* HelpFile, long TopicPos)
 			PrintString(LinkData2, TopicLink.DataLen2);
 			putchar('\n');
 		}
-		if (LinkData1) free(LinkData1);
-		if (LinkData2) free(LinkData2);
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
 		if (before31)
 		{
 			TopicPos += TopicLink.NextBlock;
@@ -4763,7 +6122,7 @@ void CTXOMAPList(FILE* HelpFile, FILE* hpj) /* write [MAP] section to HPJ file *
 
 void GuessFromKeywords(FILE* HelpFile)
 {
-	long* keytopic;
+	int32_t* keytopic;
 	char kwdata[10];
 	char kwbtree[10];
 	int m, i, n, k, l, j, map;
@@ -4798,9 +6157,9 @@ void GuessFromKeywords(FILE* HelpFile)
 						my_gets(keyword, sizeof(keyword), HelpFile);
 						m = my_getw(HelpFile);
 						KWDataOffset = getdw(HelpFile);
-						if (KWDataOffset / 4 + m > FileLength) {
+						if (KWDataOffset / 4 + m > FileLength / 4) {
 							fprintf(stderr, "malformed keytopic file\n");
-							exit(1);
+							quit(1);
 						}
 						for (j = 0; j < m; j++)
 						{
@@ -4893,19 +6252,19 @@ void FirstPass(FILE* HelpFile)
 		}
 		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
 		{
-			LinkData1 = my_malloc(TopicLink.DataLen1 - sizeof(TOPICLINK) + 1);
-			if (TopicRead(HelpFile, 0L, LinkData1, TopicLink.DataLen1 - sizeof(TOPICLINK)) != TopicLink.DataLen1 - sizeof(TOPICLINK)) break;
+			LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
 		}
 		else LinkData1 = NULL;
 		if (TopicLink.DataLen1 < TopicLink.BlockSize) /* read LinkData2 using phrase replacement */
 		{
-			LinkData2 = my_malloc(TopicLink.DataLen2 + 1);
+			LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
 			if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
 		}
 		else LinkData2 = NULL;
 		if (TopicLink.RecordType == TL_TOPICHDR) /* display a topic header record */
 		{
-			fprintf(stderr, "\rTopic %ld...", TopicNum - 15);
+			progress("\rTopic %ld...", TopicNum - 15);
 			if (before31)
 			{
 				TopicHdr30 = (TOPICHEADER30*)LinkData1;
@@ -5019,126 +6378,669 @@ void FirstPass(FILE* HelpFile)
 			}
 			for (col = 0; (TopicLink.RecordType == TL_TABLE ? *(int16_t*)ptr != -1 : col == 0) && ptr < LinkData1 + TopicLink.DataLen1 - sizeof(TOPICLINK); col++)
 			{
-				if (TopicLink.RecordType == TL_TABLE) ptr += 5;
-				ptr += 4;
-				x2 = *(uint16_t*)ptr;
-				ptr += 2;
-				if (x2 & 0x0001) scanlong(&ptr); /* found in MVBs, purpose */
-				/* unknown, may mean that x2 is really compressed long */
-				if (x2 & 0x0002) scanint(&ptr);
-				if (x2 & 0x0004) scanint(&ptr);
-				if (x2 & 0x0008) scanint(&ptr);
-				if (x2 & 0x0010) scanint(&ptr);
-				if (x2 & 0x0020) scanint(&ptr);
-				if (x2 & 0x0040) scanint(&ptr);
-				if (x2 & 0x0100) ptr += 3;
-				if (x2 & 0x0200)
+				if (TopicLink.RecordType == TL_TABLE) ptr += 5;
+				ptr += 4;
+				x2 = *(uint16_t*)ptr;
+				ptr += 2;
+				if (x2 & 0x0001) scanlong(&ptr); /* found in MVBs, purpose */
+				/* unknown, may mean that x2 is really compressed long */
+				if (x2 & 0x0002) scanint(&ptr);
+				if (x2 & 0x0004) scanint(&ptr);
+				if (x2 & 0x0008) scanint(&ptr);
+				if (x2 & 0x0010) scanint(&ptr);
+				if (x2 & 0x0020) scanint(&ptr);
+				if (x2 & 0x0040) scanint(&ptr);
+				if (x2 & 0x0100) ptr += 3;
+				if (x2 & 0x0200)
+				{
+					y1 = scanint(&ptr);
+					while (y1-- > 0) if (scanword(&ptr) & 0x4000) scanword(&ptr);
+				}
+				while (ptr < LinkData1 + TopicLink.DataLen1 - sizeof(TOPICLINK))
+				{
+					if ((unsigned char)ptr[0] == 0xFF)
+					{
+						ptr++;
+						break;
+					}
+					else switch ((unsigned char)ptr[0])
+					{
+					case 0x21: /* dtype (MVB) */
+					case 0x80: /* font change */
+						ptr += 3;
+						break;
+					case 0x81:
+					case 0x82:
+					case 0x83:
+					case 0x89: /* end of hotspot */
+					case 0x8B: /* non-break-space */
+					case 0x8C: /* non-break-hyphen */
+						ptr++;
+						break;
+					case 0x86:
+					case 0x87:
+					case 0x88:
+						ptr++;
+						x1 = *ptr++;
+						l1 = scanlong(&ptr);
+						switch (x1)
+						{
+						case 0x22: /* HC31 */
+							x1 = scanword(&ptr);
+							/* fall thru */
+						case 0x03: /* HC30 */
+							switch (((uint16_t*)ptr)[0])
+							{
+							case 1:
+								for (x2 = 1; x2 < extensions; x2++) if (!extension[x2]) break;
+								if (x2 >= extensions)
+								{
+									extension = my_realloc(extension, (x2 + 1) * sizeof(char));
+									while (extensions <= x2) extension[extensions++] = 0;
+								}
+								sprintf(filename, "bm%u", x2);
+								f = CreateMap(ptr + 2, l1 - 2);
+								x1 = ExtractBitmap(filename, f);
+								CloseMap(f);
+								extension[x2] = x1 | 0x10;
+								break;
+							}
+							break;
+						case 0x05:
+							if (ptr[6] == '!' && strchr(ptr + 7, ','))
+							{
+								CheckMacro(strchr(ptr + 7, ',') + 1);
+							}
+							break;
+						}
+						ptr += l1;
+						break;
+					case 0xC8: /* macro */
+					case 0xCC: /* macro without font change */
+						CheckMacro(ptr + 3);
+						ptr += *(int16_t*)(ptr + 1) + 3;
+						break;
+					case 0x20: /* vfld (MVC) */
+					case 0xE0: /* popup jump HC30 */
+					case 0xE1: /* topic jump HC30 */
+					case 0xE2: /* popup jump HC31 */
+					case 0xE3: /* topic jump HC31 */
+					case 0xE6: /* popup jump without font change */
+					case 0xE7: /* topic jump without font change */
+						ptr += 5;
+						break;
+					case 0xEA: /* popup jump into external file */
+					case 0xEB: /* topic jump into external file / secondary window */
+					case 0xEE: /* popup jump into external file without font change */
+					case 0xEF: /* topic jump into external file / secondary window without font change */
+						switch ((unsigned char)ptr[3])
+						{
+						case 0:
+						case 1:
+							break;
+						case 4:
+							StoreReference(ptr + 8, TOPIC, NULL, *(long*)(ptr + 4));
+							break;
+						case 6:
+							StoreReference(strchr(ptr + 8, '\0') + 1, TOPIC, NULL, *(long*)(ptr + 4));
+							break;
+						default:
+							error("Unknown modifier %02x in tag %02x", (unsigned char)ptr[3], (unsigned char)ptr[0]);
+						}
+						ptr += *(int16_t*)(ptr + 1) + 3;
+						break;
+					default:
+						error("Unknown %02x", *(unsigned char*)ptr);
+						ptr++;
+					}
+				}
+			}
+		}
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
+		if (before31)
+		{
+			TopicPos += TopicLink.NextBlock;
+		}
+		else
+		{
+			TopicOffset = NextTopicOffset(TopicOffset, TopicLink.NextBlock, TopicPos);
+			TopicPos = TopicLink.NextBlock;
+		}
+	}
+}
+
+int StopWordCmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* characters words are made of: letters and digits of Windows-1252 */
+BOOL WordChar(char c)
+{
+	return isalnum((unsigned char)c) || ((unsigned char)c >= 0xC0 && (unsigned char)c != 0xD7 && (unsigned char)c != 0xF7);
+}
+
+char WordLower(char c)
+{
+	if ((unsigned char)c >= 0xC0 && (unsigned char)c <= 0xDE && (unsigned char)c != 0xD7) return (char)((unsigned char)c + 0x20);
+	return (char)tolower((unsigned char)c);
+}
+
+BOOL StopWordFind(char* word)
+{
+	return StopWords && bsearch(&word, StopWord, StopWords, sizeof(char*), StopWordCmp) != NULL;
+}
+
+/* load stop words of the full text search index (dtype records of MVB
+// |SYSTEM naming the STOPn.STP files, like in SysList) */
+void StopLoad(FILE* HelpFile)
+{
+	SYSTEMRECORD* SysRec;
+	STOPHEADER StopHdr;
+	char* ptr;
+	int i, n;
+
+	for (SysRec = GetFirstSystemRecord(HelpFile); SysRec; SysRec = GetNextSystemRecord(SysRec))
+	{
+		if (SysRec->RecordType == 0x000C && strtok(SysRec->Data, " ") && strtok(NULL, " ") && strtok(NULL, " "))
+		{
+			ptr = strtok(NULL, " ");
+			if (ptr && SearchFile(HelpFile, ptr, NULL))
+			{
+				read_STOPHEADER(&StopHdr, HelpFile);
+				for (n = 0; n < StopHdr.BytesUsed; n += 1 + i)
+				{
+					i = getc(HelpFile);
+					if (i == EOF) break;
+					my_fread(buffer, i, HelpFile);
+					buffer[i] = '\0';
+					for (ptr = buffer; *ptr; ptr++) *ptr = WordLower(*ptr);
+					/* %100 to decrease memory fragmentation */
+					if (StopWords % 100 == 0) StopWord = my_realloc(StopWord, (StopWords + 100) * sizeof(char*));
+					StopWord[StopWords++] = my_strdup(buffer);
+				}
+			}
+		}
+	}
+	if (StopWords)
+	{
+		qsort(StopWord, StopWords, sizeof(char*), StopWordCmp);
+		progress("%d stop words loaded\n", StopWords);
+	}
+}
+
+/* add word scanned into Word to full text index unless it is a stop word.
+// Stop words still count for the position of the following words */
+void WordEnd(void)
+{
+	unsigned int key;
+	int32_t i;
+
+	if (WordLen == 0) return;
+	Word[WordLen] = '\0';
+	WordLen = 0;
+	if (StopWordFind(Word))
+	{
+		WordNum++;
+		return;
+	}
+	for (key = 0, i = 0; Word[i]; i++) key = key * 31 + (unsigned char)Word[i];
+	key %= WORDHASHSIZE;
+	for (i = WordHash[key]; i != -1; i = WordRec[i].next)
+	{
+		if (strcmp(WordRec[i].name, Word) == 0) break;
+	}
+	if (i == -1)
+	{
+		/* %100 to decrease memory fragmentation */
+		if (WordRecs % 100 == 0) WordRec = my_realloc(WordRec, (WordRecs + 100) * sizeof(WORDREC));
+		i = WordRecs++;
+		WordRec[i].name = strcpy(ArenaAlloc(&WordArena, strlen(Word) + 1), Word);
+		WordRec[i].next = WordHash[key];
+		WordRec[i].count = 0;
+		WordRec[i].topics = 0;
+		WordRec[i].lasttopic = 0;
+		WordHash[key] = i;
+	}
+	if (WordRec[i].lasttopic != WordTopics)
+	{
+		WordRec[i].lasttopic = WordTopics;
+		WordRec[i].topics++;
+	}
+	WordRec[i].count++;
+	if (WordPosRecs >= WordPosAlloc)
+	{
+		WordPosAlloc = WordPosAlloc ? 2 * WordPosAlloc : 0x1000L;
+		WordPos = my_realloc(WordPos, WordPosAlloc * sizeof(WORDPOSREC));
+	}
+	WordPos[WordPosRecs].word = i;
+	WordPos[WordPosRecs].topic = WordTopics - 1;
+	WordPos[WordPosRecs].pos = WordNum++;
+	WordPosRecs++;
+}
+
+/* split text into words for the full text index. A word may continue in
+// the next text run, as font changes can happen in the middle of it */
+void WordScan(const char* str, long len)
+{
+	while (len-- > 0)
+	{
+		if (WordChar(*str))
+		{
+			if (WordLen < sizeof(Word) - 1) Word[WordLen++] = WordLower(*str);
+		}
+		else
+		{
+			WordEnd();
+		}
+		str++;
+	}
+}
+
+/* start next topic of full text index, its title being its first words */
+void WordTopic(char* title, TOPICOFFSET TopicOffset)
+{
+	long len;
+
+	WordEnd();
+	/* %100 to decrease memory fragmentation */
+	if (WordTopics % 100 == 0) WordTopicRec = my_realloc(WordTopicRec, (WordTopics + 100) * sizeof(TOPICINDEXREC));
+	WordTopicRec[WordTopics].Pos = WordTopicRec[WordTopics].End = 0L;
+	WordTopicRec[WordTopics].Offset = TopicOffset;
+	WordTopicRec[WordTopics].Title = WordTitleSize;
+	len = strlen(title) + 1;
+	WordTitles = my_realloc(WordTitles, WordTitleSize + len);
+	memcpy(WordTitles + WordTitleSize, title, len);
+	WordTitleSize += len;
+	WordTopics++;
+	WordNum = 0;
+	WordScan(title, len);
+}
+
+int WordHitsCmp(const void* a, const void* b)
+{
+	if (((const long*)a)[0] > ((const long*)b)[0]) return -1;
+	if (((const long*)a)[0] < ((const long*)b)[0]) return 1;
+	if (((const long*)a)[1] < ((const long*)b)[1]) return -1;
+	if (((const long*)a)[1] > ((const long*)b)[1]) return 1;
+	return 0;
+}
+
+/* write len chars of text as is, as contents of a JSON string, or pass
+// them to the full text index */
+void TextWrite(FILE* out, const char* str, long len, int format)
+{
+	switch (format)
+	{
+	case TEXT_PLAIN:
+		fwrite(str, len, 1, out);
+		break;
+	case TEXT_JSON:
+		putjson(out, str, len);
+		break;
+	case TEXT_WORDS:
+		WordScan(str, len);
+		break;
+	}
+}
+
+/* remember jump or popup of current topic for -o json, strings are kept
+// in JsonArena until the topic is written */
+void JsonLinkAdd(BOOL popup, char* target, char* window, char* file)
+{
+	/* %100 to decrease memory fragmentation */
+	if (JsonLinks % 100 == 0) JsonLink = my_realloc(JsonLink, (JsonLinks + 100) * sizeof(JSONLINKREC));
+	JsonLink[JsonLinks].popup = popup;
+	JsonLink[JsonLinks].target = strcpy(ArenaAlloc(&JsonArena, strlen(target) + 1), target);
+	JsonLink[JsonLinks].window = window ? strcpy(ArenaAlloc(&JsonArena, strlen(window) + 1), window) : NULL;
+	JsonLink[JsonLinks].file = file ? strcpy(ArenaAlloc(&JsonArena, strlen(file) + 1), file) : NULL;
+	JsonLinks++;
+}
+
+/* write text of a display or table record (the strings of LinkData2 in
+// between the commands of LinkData1) to out, turning line and paragraph
+// breaks into newlines and tabs into tabs. Commands are skipped like in
+// FirstPass, so nothing but the text is looked at. For TEXT_JSON jumps
+// and popups are collected by JsonLinkAdd */
+void TextParagraphs(FILE* out, TOPICLINK* TopicLink, char* LinkData1, char* LinkData2, int format)
+{
+	char* ptr;
+	char* end;
+	char* str;
+	char* strend;
+	char* arg;
+	int col, cols, x1, x2, y1;
+	long l1;
+	BOOL newline;
+
+	newline = TRUE;
+	ptr = LinkData1;
+	end = LinkData1 + TopicLink->DataLen1 - sizeof(TOPICLINK);
+	str = LinkData2;
+	strend = LinkData2 + TopicLink->DataLen2;
+	scanlong(&ptr);
+	if (TopicLink->RecordType == TL_DISPLAY || TopicLink->RecordType == TL_TABLE) scanword(&ptr);
+	if (TopicLink->RecordType == TL_TABLE)
+	{
+		cols = (unsigned char)*ptr++;
+		x1 = (unsigned char)*ptr++;
+		if (x1 == 0 || x1 == 2) ptr += 2;
+		ptr += 4 * cols;
+	}
+	for (col = 0; (TopicLink->RecordType == TL_TABLE ? *(int16_t*)ptr != -1 : col == 0) && ptr < end; col++)
+	{
+		if (TopicLink->RecordType == TL_TABLE) ptr += 5;
+		ptr += 4;
+		x2 = *(uint16_t*)ptr;
+		ptr += 2;
+		if (x2 & 0x0001) scanlong(&ptr);
+		if (x2 & 0x0002) scanint(&ptr);
+		if (x2 & 0x0004) scanint(&ptr);
+		if (x2 & 0x0008) scanint(&ptr);
+		if (x2 & 0x0010) scanint(&ptr);
+		if (x2 & 0x0020) scanint(&ptr);
+		if (x2 & 0x0040) scanint(&ptr);
+		if (x2 & 0x0100) ptr += 3;
+		if (x2 & 0x0200)
+		{
+			y1 = scanint(&ptr);
+			while (y1-- > 0) if (scanword(&ptr) & 0x4000) scanword(&ptr);
+		}
+		while (ptr < end && str < strend)
+		{
+			l1 = strlen(str);
+			if (l1)
+			{
+				TextWrite(out, str, l1, format);
+				newline = FALSE;
+			}
+			str += l1 + 1;
+			if ((unsigned char)ptr[0] == 0xFF)
+			{
+				ptr++;
+				break;
+			}
+			switch ((unsigned char)ptr[0])
+			{
+			case 0x21: /* dtype (MVB) */
+			case 0x80: /* font change */
+				ptr += 3;
+				break;
+			case 0x81: /* line break */
+			case 0x82: /* end of paragraph */
+				TextWrite(out, "\n", 1, format);
+				newline = TRUE;
+				ptr++;
+				break;
+			case 0x83:
+				TextWrite(out, "\t", 1, format);
+				newline = FALSE;
+				ptr++;
+				break;
+			case 0x8B: /* non-break-space */
+				TextWrite(out, " ", 1, format);
+				newline = FALSE;
+				ptr++;
+				break;
+			case 0x8C: /* non-break-hyphen */
+				TextWrite(out, "-", 1, format);
+				newline = FALSE;
+				ptr++;
+				break;
+			case 0x86:
+			case 0x87:
+			case 0x88:
+				ptr += 2;
+				l1 = scanlong(&ptr);
+				ptr += l1;
+				break;
+			case 0xEA: /* popup jump into external file */
+			case 0xEB: /* topic jump into external file / secondary window */
+			case 0xEE:
+			case 0xEF:
+				if (format == TEXT_JSON)
+				{
+					arg = unhash(*(int32_t*)(ptr + 4)); /* no ContextId, it may jump into external file */
+					switch ((unsigned char)ptr[3])
+					{
+					case 0:
+						JsonLinkAdd(((unsigned char)ptr[0] & 1) == 0, arg, NULL, NULL);
+						break;
+					case 1:
+						JsonLinkAdd(((unsigned char)ptr[0] & 1) == 0, arg, GetWindowName(ptr[8]), NULL);
+						break;
+					case 4:
+						JsonLinkAdd(((unsigned char)ptr[0] & 1) == 0, arg, NULL, ptr + 8);
+						break;
+					case 6:
+						JsonLinkAdd(((unsigned char)ptr[0] & 1) == 0, arg, ptr + 8, strchr(ptr + 8, '\0') + 1);
+						break;
+					}
+				}
+				ptr += *(int16_t*)(ptr + 1) + 3;
+				break;
+			case 0xC8: /* macro */
+			case 0xCC: /* macro without font change */
+				ptr += *(int16_t*)(ptr + 1) + 3;
+				break;
+			case 0xE0: /* popup jump HC30 */
+			case 0xE1: /* topic jump HC30 */
+				if (format == TEXT_JSON)
+				{
+					sprintf(buffer, "TOPIC%ld", (long)*(int32_t*)(ptr + 1));
+					JsonLinkAdd((unsigned char)ptr[0] == 0xE0, buffer, NULL, NULL);
+				}
+				ptr += 5;
+				break;
+			case 0xE2: /* popup jump HC31 */
+			case 0xE3: /* topic jump HC31 */
+			case 0xE6: /* popup jump without font change */
+			case 0xE7: /* topic jump without font change */
+				if (format == TEXT_JSON) JsonLinkAdd(((unsigned char)ptr[0] & 1) == 0, unhash(*(int32_t*)(ptr + 1)), NULL, NULL);
+				ptr += 5;
+				break;
+			case 0x20: /* vfld (MVC) */
+				ptr += 5;
+				break;
+			default: /* 0x89 end of hotspot and unknown */
+				ptr++;
+			}
+		}
+	}
+	if (!newline) TextWrite(out, "\n", 1, format);
+}
+
+/* write a JSON array of strings, skipping separator in front of first one */
+void JsonString(FILE* out, const char* str, BOOL* first)
+{
+	if (!*first) putc(',', out);
+	*first = FALSE;
+	putc('"', out);
+	putjson(out, str, strlen(str));
+	putc('"', out);
+}
+
+/* finish JSON object of topic by writing its context ids, keywords and
+// links. Context ids and keywords are assigned to topic offsets (topic
+// positions in 3.0 files) up to limit, the start of the next topic */
+void JsonTopicEnd(FILE* HelpFile, FILE* out, long TopicNum, int* NextContextRec, long limit)
+{
+	BOOL first;
+	int i;
+
+	fputs("\",\"contextids\":[", out);
+	first = TRUE;
+	if (before31)
+	{
+		sprintf(buffer, "TOPIC%ld", TopicNum + 15);
+		JsonString(out, buffer, &first);
+	}
+	while (*NextContextRec < ContextRecs && ContextRec[*NextContextRec].TopicOffset < limit)
+	{
+		JsonString(out, unhash(ContextRec[*NextContextRec].HashValue), &first);
+		(*NextContextRec)++;
+	}
+	fputs("],\"keywords\":[", out);
+	first = TRUE;
+	while (1)
+	{
+		if (NextKeywordRec >= KeywordRecs)
+		{
+			if (NextKeywordOffset == 0x7FFFFFFFL) break;
+			CollectKeywords(HelpFile);
+			if (NextKeywordRec >= KeywordRecs) break;
+		}
+		if (KeywordRec[NextKeywordRec].TopicOffset >= limit) break;
+		if (!first) putc(',', out);
+		first = FALSE;
+		fprintf(out, "{\"list\":\"%c\",\"keyword\":\"", KeywordRec[NextKeywordRec].Footnote);
+		putjson(out, KeywordRec[NextKeywordRec].Keyword, strlen(KeywordRec[NextKeywordRec].Keyword));
+		fputs("\"}", out);
+		NextKeywordRec++;
+	}
+	fputs("],\"links\":[", out);
+	for (i = 0; i < JsonLinks; i++)
+	{
+		if (i) putc(',', out);
+		fprintf(out, "{\"type\":\"%s\",\"target\":\"", JsonLink[i].popup ? "popup" : "jump");
+		putjson(out, JsonLink[i].target, strlen(JsonLink[i].target));
+		putc('"', out);
+		if (JsonLink[i].window)
+		{
+			fputs(",\"window\":\"", out);
+			putjson(out, JsonLink[i].window, strlen(JsonLink[i].window));
+			putc('"', out);
+		}
+		if (JsonLink[i].file)
+		{
+			fputs(",\"file\":\"", out);
+			putjson(out, JsonLink[i].file, strlen(JsonLink[i].file));
+			putc('"', out);
+		}
+		putc('}', out);
+	}
+	fputs("]}\n", out);
+	fflush(out);
+	JsonLinks = 0;
+	ArenaReset(&JsonArena);
+}
+
+/* write JSON browse neighbour, null if there is none */
+void JsonBrowse(FILE* out, const char* name, long value)
+{
+	if (value == -1L)
+	{
+		fprintf(out, "\"%s\":null", name);
+	}
+	else
+	{
+		fprintf(out, "\"%s\":%ld", name, value);
+	}
+}
+
+/* write title and text of each topic to out for search indexing (option
+// -o text), separating topics by form feeds. Streams through |TOPIC once,
+// skipping bitmaps, fonts, keywords and browse sequences. For TEXT_JSON
+// (option -o json), each topic is written as one line holding a JSON
+// object that also lists context ids, keywords, browse neighbours, window
+// and links of the topic, flushed as soon as the topic is complete. For
+// TEXT_WORDS (option -o index) the words are added to the full text index */
+void TextDump(FILE* HelpFile, FILE* out, int format)
+{
+	TOPICLINK TopicLink;
+	TOPICHEADER30* TopicHdr30;
+	TOPICHEADER* TopicHdr;
+	char* LinkData1;
+	char* LinkData2;
+	char* ptr;
+	long TopicPos, TopicNum, TopicOffset;
+	int NextContextRec, i;
+
+	if (!SearchFile(HelpFile, "|TOPIC", &TopicFileLength)) return;
+	TopicOffset = 0L;
+	TopicPos = 12L;
+	TopicNum = 0L;
+	NextContextRec = 0;
+	while (TopicRead(HelpFile, TopicPos, &TopicLink, sizeof(TopicLink)) == sizeof(TOPICLINK))
+	{
+		if (before31)
+		{
+			if (TopicPos + TopicLink.NextBlock >= TopicFileLength) break;
+		}
+		else
+		{
+			if (TopicLink.NextBlock <= 0) break;
+		}
+		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
+		{
+			LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
+		}
+		else LinkData1 = NULL;
+		if (LinkData1 && TopicLink.DataLen1 < TopicLink.BlockSize && (TopicLink.RecordType == TL_TOPICHDR || TopicLink.RecordType == TL_DISPLAY30 || TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE))
+		{
+			LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
+			if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
+			if (TopicLink.RecordType == TL_TOPICHDR)
+			{
+				if (format == TEXT_WORDS)
 				{
-					y1 = scanint(&ptr);
-					while (y1-- > 0) if (scanword(&ptr) & 0x4000) scanword(&ptr);
+					WordTopic(LinkData2, before31 ? TopicPos : TopicOffset);
 				}
-				while (ptr < LinkData1 + TopicLink.DataLen1 - sizeof(TOPICLINK))
+				else if (format == TEXT_JSON)
 				{
-					if ((unsigned char)ptr[0] == 0xFF)
+					if (TopicNum) JsonTopicEnd(HelpFile, out, TopicNum, &NextContextRec, before31 ? TopicPos : TopicOffset);
+					fprintf(out, "{\"topic\":%ld,\"offset\":%ld,\"title\":\"", TopicNum + 1, before31 ? TopicPos : TopicOffset);
+					putjson(out, LinkData2, strlen(LinkData2));
+					fputs("\",\"browse\":{", out);
+					if (before31)
 					{
-						ptr++;
-						break;
+						TopicHdr30 = (TOPICHEADER30*)LinkData1;
+						JsonBrowse(out, "prev", TopicHdr30->PrevTopicNum);
+						putc(',', out);
+						JsonBrowse(out, "next", TopicHdr30->NextTopicNum);
 					}
-					else switch ((unsigned char)ptr[0])
+					else
 					{
-					case 0x21: /* dtype (MVB) */
-					case 0x80: /* font change */
-						ptr += 3;
-						break;
-					case 0x81:
-					case 0x82:
-					case 0x83:
-					case 0x89: /* end of hotspot */
-					case 0x8B: /* non-break-space */
-					case 0x8C: /* non-break-hyphen */
-						ptr++;
-						break;
-					case 0x86:
-					case 0x87:
-					case 0x88:
-						ptr++;
-						x1 = *ptr++;
-						l1 = scanlong(&ptr);
-						switch (x1)
-						{
-						case 0x22: /* HC31 */
-							x1 = scanword(&ptr);
-							/* fall thru */
-						case 0x03: /* HC30 */
-							switch (((uint16_t*)ptr)[0])
-							{
-							case 1:
-								for (x2 = 1; x2 < extensions; x2++) if (!extension[x2]) break;
-								if (x2 >= extensions)
-								{
-									extension = my_realloc(extension, (x2 + 1) * sizeof(char));
-									while (extensions <= x2) extension[extensions++] = 0;
-								}
-								sprintf(filename, "bm%u", x2);
-								f = CreateMap(ptr + 2, l1 - 2);
-								x1 = ExtractBitmap(filename, f);
-								CloseMap(f);
-								extension[x2] = x1 | 0x10;
-								break;
-							}
-							break;
-						case 0x05:
-							if (ptr[6] == '!' && strchr(ptr + 7, ','))
-							{
-								CheckMacro(strchr(ptr + 7, ',') + 1);
-							}
-							break;
-						}
-						ptr += l1;
-						break;
-					case 0xC8: /* macro */
-					case 0xCC: /* macro without font change */
-						CheckMacro(ptr + 3);
-						ptr += *(int16_t*)(ptr + 1) + 3;
-						break;
-					case 0x20: /* vfld (MVC) */
-					case 0xE0: /* popup jump HC30 */
-					case 0xE1: /* topic jump HC30 */
-					case 0xE2: /* popup jump HC31 */
-					case 0xE3: /* topic jump HC31 */
-					case 0xE6: /* popup jump without font change */
-					case 0xE7: /* topic jump without font change */
-						ptr += 5;
-						break;
-					case 0xEA: /* popup jump into external file */
-					case 0xEB: /* topic jump into external file / secondary window */
-					case 0xEE: /* popup jump into external file without font change */
-					case 0xEF: /* topic jump into external file / secondary window without font change */
-						switch ((unsigned char)ptr[3])
-						{
-						case 0:
-						case 1:
-							break;
-						case 4:
-							StoreReference(ptr + 8, TOPIC, NULL, *(long*)(ptr + 4));
-							break;
-						case 6:
-							StoreReference(strchr(ptr + 8, '\0') + 1, TOPIC, NULL, *(long*)(ptr + 4));
-							break;
-						default:
-							error("Unknown modifier %02x in tag %02x", (unsigned char)ptr[3], (unsigned char)ptr[0]);
-						}
-						ptr += *(int16_t*)(ptr + 1) + 3;
-						break;
-					default:
-						error("Unknown %02x", *(unsigned char*)ptr);
-						ptr++;
+						TopicHdr = (TOPICHEADER*)LinkData1;
+						JsonBrowse(out, "prev", (int32_t)TopicHdr->BrowseBck);
+						putc(',', out);
+						JsonBrowse(out, "next", (int32_t)TopicHdr->BrowseFor);
+					}
+					fputs("},\"window\":", out);
+					i = before31 ? -1 : ListWindows(HelpFile, TopicOffset);
+					if (i != -1)
+					{
+						putc('"', out);
+						putjson(out, GetWindowName(i), strlen(GetWindowName(i)));
+						putc('"', out);
+					}
+					else
+					{
+						fputs("null", out);
 					}
+					fputs(",\"text\":\"", out);
+				}
+				else
+				{
+					if (TopicNum) putc('\f', out);
+					fputs(LinkData2, out);
+					putc('\n', out);
 				}
+				TopicNum++;
+			}
+			else if (TopicNum || format == TEXT_PLAIN)
+			{
+				TextParagraphs(out, &TopicLink, LinkData1, LinkData2, format);
 			}
 		}
-		if (LinkData1) free(LinkData1);
-		if (LinkData2) free(LinkData2);
+		if (LinkData1 && (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE))
+		{
+			ptr = LinkData1;
+			scanlong(&ptr);
+			TopicOffset += scanword(&ptr);
+		}
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
 		if (before31)
 		{
 			TopicPos += TopicLink.NextBlock;
@@ -5149,6 +7051,264 @@ void FirstPass(FILE* HelpFile)
 			TopicPos = TopicLink.NextBlock;
 		}
 	}
+	if (format == TEXT_JSON && TopicNum) JsonTopicEnd(HelpFile, out, TopicNum, &NextContextRec, 0x7FFFFFFFL);
+}
+
+int WordRecCmp(const void* a, const void* b)
+{
+	return strcmp(WordRec[*(const long*)a].name, WordRec[*(const long*)b].name);
+}
+
+/* write full text index (option -o index) to filename: dword "HDW1",
+// EntireFileSize of help file and length of |TOPIC to detect a changed
+// help file, number of topics, words, postings and size of strings, per
+// topic its TOPICOFFSET and the offset of its title, per word (sorted by
+// strcmp) the offset of its name, index of its first posting, number of
+// postings and number of topics containing it, per posting the topic
+// (0 = first) and position of the word in the topic, followed by the
+// strings. All records are made of little endian dwords, so the file can
+// be searched where it is loaded or mapped. Returns number of words */
+#define WORDINDEXMAGIC 0x31574448L
+long WordIndexWrite(FILE* HelpFile, const char* filename)
+{
+	HELPHEADER Header;
+	WORDPOSREC* pos;
+	long* sorted;
+	long i, n, strings;
+	FILE* f;
+
+	fseek(HelpFile, 0L, SEEK_SET);
+	read_HELPHEADER(&Header, HelpFile);
+	for (i = 0; i < WORDHASHSIZE; i++) WordHash[i] = -1;
+	TextDump(HelpFile, NULL, TEXT_WORDS);
+	WordEnd();
+	if (!WordTopics) return 0L;
+	sorted = my_malloc((WordRecs + 1) * sizeof(long));
+	for (i = 0; i < WordRecs; i++) sorted[i] = i;
+	qsort(sorted, WordRecs, sizeof(long), WordRecCmp);
+	for (n = i = 0; i < WordRecs; i++)
+	{
+		WordRec[sorted[i]].first = n;
+		n += WordRec[sorted[i]].count;
+	}
+	/* postings were added topic by topic, so distributing them keeps them
+	// ordered by topic and position for each word */
+	pos = my_malloc((WordPosRecs + 1) * sizeof(WORDPOSREC));
+	for (i = 0; i < WordRecs; i++) WordRec[i].lasttopic = WordRec[i].first;
+	for (i = 0; i < WordPosRecs; i++) pos[WordRec[WordPos[i].word].lasttopic++] = WordPos[i];
+	f = my_fopen(filename, "wb");
+	if (f)
+	{
+		strings = WordTitleSize;
+		for (i = 0; i < WordRecs; i++) strings += strlen(WordRec[i].name) + 1;
+		putdw(WORDINDEXMAGIC, f);
+		putdw(Header.EntireFileSize, f);
+		putdw(TopicFileLength, f);
+		putdw(WordTopics, f);
+		putdw(WordRecs, f);
+		putdw(WordPosRecs, f);
+		putdw(strings, f);
+		for (i = 0; i < WordTopics; i++)
+		{
+			putdw(WordTopicRec[i].Offset, f);
+			putdw(WordTopicRec[i].Title, f);
+		}
+		strings = WordTitleSize;
+		for (i = 0; i < WordRecs; i++)
+		{
+			putdw(strings, f);
+			putdw(WordRec[sorted[i]].first, f);
+			putdw(WordRec[sorted[i]].count, f);
+			putdw(WordRec[sorted[i]].topics, f);
+			strings += strlen(WordRec[sorted[i]].name) + 1;
+		}
+		for (i = 0; i < WordPosRecs; i++)
+		{
+			putdw(pos[i].topic, f);
+			putdw(pos[i].pos, f);
+		}
+		fwrite(WordTitles, WordTitleSize, 1, f);
+		for (i = 0; i < WordRecs; i++) fwrite(WordRec[sorted[i]].name, strlen(WordRec[sorted[i]].name) + 1, 1, f);
+		my_fclose(f);
+		n = WordRecs;
+	}
+	else n = 0L;
+	free(pos);
+	free(sorted);
+	if (WordRec) free(WordRec);
+	if (WordPos) free(WordPos);
+	if (WordTopicRec) free(WordTopicRec);
+	if (WordTitles) free(WordTitles);
+	WordRec = NULL;
+	WordPos = NULL;
+	WordTopicRec = NULL;
+	WordTitles = NULL;
+	WordRecs = WordPosRecs = WordPosAlloc = WordTopics = WordTitleSize = 0L;
+	ArenaReset(&WordArena);
+	return n;
+}
+
+/* first posting of topic in postings first to first + count - 1 of the
+// word index, or first + count if the word doesn't appear in topic */
+uint32_t WordPosFind(const char* postings, uint32_t first, uint32_t count, uint32_t topic)
+{
+	uint32_t i, j, k;
+
+	i = first;
+	j = first + count;
+	while (i < j)
+	{
+		k = (i + j) / 2;
+		if (read_u32_le(postings + 8 * k) < topic)
+		{
+			i = k + 1;
+		}
+		else
+		{
+			j = k;
+		}
+	}
+	return i;
+}
+
+/* list topics containing all words of query using full text index
+// filename written by WordIndexWrite, those with most hits first. Returns
+// number of topics listed or -1 if the index can't be used */
+#define MAXQUERYWORDS 32
+long WordQuery(FILE* HelpFile, const char* filename, const char* query)
+{
+	HELPHEADER Header;
+	uint32_t topics, words, postings, strings;
+	uint32_t term[MAXQUERYWORDS];
+	uint32_t first, count, topic, p, q;
+	int terms, i, j, k, n;
+	long size, results, hits;
+	long* result;
+	char* data;
+	char* topicrecs;
+	char* wordrecs;
+	char* posrecs;
+	char* str;
+	char* name;
+	long filesize;
+	FILE* f;
+
+	f = fopen(filename, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "Full text index %s not found, create it using option -o index.\n", filename);
+		return -1L;
+	}
+	fseek(f, 0L, SEEK_END);
+	filesize = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	fseek(HelpFile, 0L, SEEK_SET);
+	read_HELPHEADER(&Header, HelpFile);
+	if (getdw(f) != WORDINDEXMAGIC || getdw(f) != Header.EntireFileSize || !SearchFile(HelpFile, "|TOPIC", &TopicFileLength) || getdw(f) != TopicFileLength)
+	{
+		fprintf(stderr, "Full text index %s doesn't match help file, create it again using option -o index.\n", filename);
+		fclose(f);
+		return -1L;
+	}
+	topics = getdw(f);
+	words = getdw(f);
+	postings = getdw(f);
+	strings = getdw(f);
+	size = filesize - 28L;
+	if (size < 0L || topics > size / 8L || words > size / 16L || postings > size / 8L || strings > size || size != 8L * topics + 16L * words + 8L * postings + strings)
+	{
+		fprintf(stderr, "Full text index %s is damaged.\n", filename);
+		fclose(f);
+		return -1L;
+	}
+	data = my_malloc(size + 1);
+	my_fread(data, size, f);
+	fclose(f);
+	data[size] = '\0';
+	topicrecs = data;
+	wordrecs = topicrecs + 8L * topics;
+	posrecs = wordrecs + 16L * words;
+	str = posrecs + 8L * postings;
+	/* all string offsets and posting ranges must lie within the index */
+	for (p = 0; p < topics && read_u32_le(topicrecs + 8 * p + 4) < strings; p++);
+	for (q = 0; q < words && read_u32_le(wordrecs + 16 * q) < strings && read_u32_le(wordrecs + 16 * q + 4) <= postings && read_u32_le(wordrecs + 16 * q + 8) <= postings - read_u32_le(wordrecs + 16 * q + 4); q++);
+	if (p < topics || q < words)
+	{
+		fprintf(stderr, "Full text index %s is damaged.\n", filename);
+		free(data);
+		return -1L;
+	}
+	terms = 0;
+	while (*query)
+	{
+		for (WordLen = 0; *query && !WordChar(*query); query++);
+		for (; WordChar(*query); query++) if (WordLen < sizeof(Word) - 1) Word[WordLen++] = WordLower(*query);
+		Word[WordLen] = '\0';
+		if (WordLen == 0 || StopWordFind(Word)) continue;
+		if (terms == MAXQUERYWORDS) break;
+		i = 0;
+		j = words;
+		while (i < j)
+		{
+			k = (i + j) / 2;
+			name = str + read_u32_le(wordrecs + 16 * k);
+			n = strcmp(name, Word);
+			if (n < 0)
+			{
+				i = k + 1;
+			}
+			else if (n > 0)
+			{
+				j = k;
+			}
+			else break;
+		}
+		if (i >= j) /* word not in any topic */
+		{
+			free(data);
+			return 0L;
+		}
+		term[terms++] = k;
+	}
+	WordLen = 0;
+	results = 0L;
+	result = NULL;
+	if (terms)
+	{
+		/* walk topics of the word found in least topics, check others */
+		for (i = 1, j = 0; i < terms; i++) if (read_u32_le(wordrecs + 16 * term[i] + 12) < read_u32_le(wordrecs + 16 * term[j] + 12)) j = i;
+		first = read_u32_le(wordrecs + 16 * term[j] + 4);
+		count = read_u32_le(wordrecs + 16 * term[j] + 8);
+		for (p = first; p < first + count; p = q)
+		{
+			topic = read_u32_le(posrecs + 8 * p);
+			for (q = p; q < first + count && read_u32_le(posrecs + 8 * q) == topic; q++);
+			hits = q - p;
+			for (i = 0; i < terms && hits; i++) if (i != j)
+			{
+				k = WordPosFind(posrecs, read_u32_le(wordrecs + 16 * term[i] + 4), read_u32_le(wordrecs + 16 * term[i] + 8), topic);
+				for (n = 0; k + n < read_u32_le(wordrecs + 16 * term[i] + 4) + read_u32_le(wordrecs + 16 * term[i] + 8) && read_u32_le(posrecs + 8 * (k + n)) == topic; n++);
+				hits = n ? hits + n : 0L;
+			}
+			if (hits && topic < topics)
+			{
+				/* %100 to decrease memory fragmentation */
+				if (results % 100 == 0) result = my_realloc(result, (results + 100) * 2 * sizeof(long));
+				result[2 * results] = hits;
+				result[2 * results + 1] = topic;
+				results++;
+			}
+		}
+		qsort(result, results, 2 * sizeof(long), WordHitsCmp);
+		for (i = 0; i < results; i++)
+		{
+			topic = result[2 * i + 1];
+			printf("Topic %ld: %s (%ld hits, offset 0x%lx)\n", (long)topic + 1, str + read_u32_le(topicrecs + 8 * topic + 4), result[2 * i], (long)read_u32_le(topicrecs + 8 * topic));
+		}
+		if (result) free(result);
+	}
+	free(data);
+	return results;
 }
 
 int CTXOMAPRecCmp(const void* a, const void* b)
@@ -5200,13 +7360,13 @@ void ContextList(FILE* HelpFile)
 	{
 		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
 		{
-			LinkData1 = my_malloc(TopicLink.DataLen1 - sizeof(TOPICLINK) + 1);
-			if (TopicRead(HelpFile, 0L, LinkData1, TopicLink.DataLen1 - sizeof(TOPICLINK)) != TopicLink.DataLen1 - sizeof(TOPICLINK)) break;
+			LinkData1 = TopicView(HelpFile, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
 		}
 		else LinkData1 = NULL;
 		if (TopicLink.DataLen1 < TopicLink.BlockSize) /* read LinkData2 using phrase replacement */
 		{
-			LinkData2 = my_malloc(TopicLink.DataLen2 + 1);
+			LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
 			if (TopicPhraseRead(HelpFile, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
 		}
 		else LinkData2 = NULL;
@@ -5272,38 +7432,116 @@ void ContextList(FILE* HelpFile)
 			}
 			else
 			{
-				len = printf("Topic %ld: untitled: ", TopicNum);
+				len = printf("Topic %ld: untitled: ", TopicNum);
+			}
+			TopicNum++;
+		}
+		else if (LinkData2 && len < 79)
+		{
+			for (ptr = LinkData2; len < 79 && ptr < LinkData2 + TopicLink.DataLen2; ptr++) if (*ptr)
+			{
+				putchar(*ptr);
+				len++;
+			}
+		}
+		if (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE)
+		{
+			ptr = LinkData1;
+			scanlong(&ptr);
+			TopicOffset += scanword(&ptr);
+		}
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
+		if (before31)
+		{
+			if (TopicPos + TopicLink.NextBlock >= TopicFileLength) break;
+			TopicPos += TopicLink.NextBlock;
+		}
+		else
+		{
+			if (TopicLink.NextBlock <= 0) break;
+			TopicOffset = NextTopicOffset(TopicOffset, TopicLink.NextBlock, TopicPos);
+			TopicPos = TopicLink.NextBlock;
+		}
+	}
+}
+
+#ifdef _WIN32
+#define WallTime() ((double)clock() / CLOCKS_PER_SEC) /* clock counts wall time on Windows */
+#endif
+
+/* counters of phase from StatsStart on */
+void StatsCount(STATSPHASE* phase, const char* name, double wall, double cpu, const STATS* start)
+{
+	phase->name = name;
+	phase->wall = WallTime() - wall;
+	phase->cpu = (double)clock() / CLOCKS_PER_SEC - cpu;
+	phase->count.BytesRead = Stats.BytesRead - start->BytesRead;
+	phase->count.SearchFiles = Stats.SearchFiles - start->SearchFiles;
+	phase->count.BTreePages = Stats.BTreePages - start->BTreePages;
+	phase->count.Blocks = Stats.Blocks - start->Blocks;
+	phase->count.Decompressed = Stats.Decompressed - start->Decompressed;
+	phase->count.Phrases = Stats.Phrases - start->Phrases;
+	phase->count.Mallocs = Stats.Mallocs - start->Mallocs;
+	phase->count.MallocBytes = Stats.MallocBytes - start->MallocBytes;
+	phase->count.Written = Stats.Written - start->Written;
+}
+
+/* end current phase of option --stats (if any) and start phase name,
+// which must be a constant. StatsBegin(NULL) just ends current phase */
+void StatsBegin(const char* name)
+{
+	if (!stats) return;
+	if (StatsName && StatsPhases < STATSPHASES)
+	{
+		StatsCount(StatsPhase + StatsPhases++, StatsName, StatsWall, StatsCpu, &StatsStart);
+	}
+	StatsName = name;
+	StatsStart = Stats;
+	StatsWall = WallTime();
+	StatsCpu = (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* write phases and total to stderr, as table or as JSON in one line */
+void StatsReport(double wall, double cpu)
+{
+	static const STATS zero;
+	STATSPHASE total;
+	STATSPHASE* phase;
+	int i;
+
+	StatsBegin(NULL);
+	StatsCount(&total, "total", wall, cpu, &zero);
+	if (stats == 2)
+	{
+		fputs("{\"phases\":[", stderr);
+	}
+	else
+	{
+		fprintf(stderr, "%-18s %8s %8s %10s %6s %6s %6s %10s %8s %8s %10s %10s\n", "phase", "wall", "cpu", "read", "search", "pages", "blocks", "decompr", "phrases", "mallocs", "allocated", "written");
+	}
+	for (i = 0; i <= StatsPhases; i++)
+	{
+		phase = i < StatsPhases ? StatsPhase + i : &total;
+		if (stats == 2)
+		{
+			if (i == StatsPhases)
+			{
+				fputs("],\"total\":", stderr);
 			}
-			TopicNum++;
-		}
-		else if (LinkData2 && len < 79)
-		{
-			for (ptr = LinkData2; len < 79 && ptr < LinkData2 + TopicLink.DataLen2; ptr++) if (*ptr)
+			else if (i)
 			{
-				putchar(*ptr);
-				len++;
+				putc(',', stderr);
 			}
-		}
-		if (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE)
-		{
-			ptr = LinkData1;
-			scanlong(&ptr);
-			TopicOffset += scanword(&ptr);
-		}
-		if (LinkData1) free(LinkData1);
-		if (LinkData2) free(LinkData2);
-		if (before31)
-		{
-			if (TopicPos + TopicLink.NextBlock >= TopicFileLength) break;
-			TopicPos += TopicLink.NextBlock;
+			fprintf(stderr, "{\"phase\":\"%s\",\"wall\":%.6f,\"cpu\":%.6f,\"bytesread\":%ld,\"searchfile\":%ld,\"btreepages\":%ld,\"blocks\":%ld,\"decompressed\":%ld,\"phrases\":%ld,\"mallocs\":%ld,\"mallocbytes\":%ld,\"written\":%ld}",
+				phase->name, phase->wall, phase->cpu, phase->count.BytesRead, phase->count.SearchFiles, phase->count.BTreePages, phase->count.Blocks, phase->count.Decompressed, phase->count.Phrases, phase->count.Mallocs, phase->count.MallocBytes, phase->count.Written);
 		}
 		else
 		{
-			if (TopicLink.NextBlock <= 0) break;
-			TopicOffset = NextTopicOffset(TopicOffset, TopicLink.NextBlock, TopicPos);
-			TopicPos = TopicLink.NextBlock;
+			fprintf(stderr, "%-18s %8.3f %8.3f %10ld %6ld %6ld %6ld %10ld %8ld %8ld %10ld %10ld\n",
+				phase->name, phase->wall, phase->cpu, phase->count.BytesRead, phase->count.SearchFiles, phase->count.BTreePages, phase->count.Blocks, phase->count.Decompressed, phase->count.Phrases, phase->count.Mallocs, phase->count.MallocBytes, phase->count.Written);
 		}
 	}
+	if (stats == 2) fputs("}\n", stderr);
 }
 
 BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, long offset)
@@ -5313,6 +7551,7 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 	long FileLength;
 	FILE* rtf;
 	FILE* hpj;
+	char* ptr;
 	int d;
 	long topic;
 
@@ -5322,15 +7561,23 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 		switch (mode)
 		{
 		case 0:
+			StatsBegin("SysLoad");
 			SysLoad(HelpFile);
 			fprintf(stderr, "Decompiling %s...\n", HelpFileTitle);
+			StatsBegin("ContextLoad");
 			ContextLoad(HelpFile);
+			StatsBegin("PhraseLoad");
 			PhraseLoad(HelpFile);
+			if (PhraseCount) progress("%u phrases loaded\n", PhraseCount);
+			StatsBegin("ExportBitmaps");
 			ExportBitmaps(HelpFile);
 			fputs("Pass 1...\n", stderr);
+			StatsBegin("FirstPass");
 			FirstPass(HelpFile); /* valid only after ExportBitmaps */
 			putc('\n', stderr);
+			StatsBegin("GuessFromKeywords");
 			if (!before31 && guessing) GuessFromKeywords(HelpFile); /* after FirstPass, before SysList */
+			StatsBegin("SysList");
 			strcpy(hpjfilename, name);
 			if (mvp)
 			{
@@ -5358,17 +7605,20 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 					FontLoad(HelpFile, rtf, hpj);
 					fputs("Pass 2...\n", stderr);
 					fprintf(hpj, "[FILES]\n%s\n\n", filename);
+					StatsBegin("TopicDump");
 					rtf = TopicDump(HelpFile, rtf, hpj, FALSE);
 					putc('}', rtf);
 					putc('\n', stderr);
 					my_fclose(rtf);
 				}
 				NotInAnyTopic = FALSE;
+				StatsBegin("CTXOMAPList");
 				CTXOMAPList(HelpFile, hpj);
 				if (extensions && before31) ListBitmaps(hpj);
 				if (win95) ListRose(HelpFile, hpj);
 				my_fclose(hpj);
 			}
+			StatsBegin(NULL);
 			if (PhraseOffsets)
 			{
 				if (win95)
@@ -5406,7 +7656,7 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 			fprintf(stderr, "Writing %s...\n", HelpFileTitle);
 			exportplain = TRUE;
 			ExportBitmaps(HelpFile);
-			PhraseLoad(HelpFile);
+			PhraseDefer(HelpFile);
 			BuildName(filename, TopicsPerRTF > 0);
 			rtf = my_fopen(filename, "wt");
 			if (rtf)
@@ -5422,9 +7672,9 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 			SysLoad(HelpFile);
 			fprintf(stderr, "Scanning %s...\n", HelpFileTitle);
 			ContextLoad(HelpFile);
-			PhraseLoad(HelpFile);
+			PhraseDefer(HelpFile);
 			checkexternal = TRUE;
-			ExportBitmaps(HelpFile);
+			/* no ExportBitmaps, bitmaps are not needed for contents */
 			FirstPass(HelpFile);
 			putc('\n', stderr);
 			if (!before31 && guessing) GuessFromKeywords(HelpFile); /* after FirstPass, before SysList */
@@ -5443,7 +7693,7 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 			SysLoad(HelpFile);
 			fprintf(stderr, "Parsing %s...\n", HelpFileTitle);
 			ContextLoad(HelpFile);
-			PhraseLoad(HelpFile);
+			PhraseDefer(HelpFile);
 			ExportBitmaps(HelpFile);
 			FirstPass(HelpFile);
 			putc('\n', stderr);
@@ -5456,7 +7706,7 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 			checkexternal = TRUE;
 			SysLoad(HelpFile);
 			fprintf(stderr, "Checking %s...\n", HelpFileTitle);
-			PhraseLoad(HelpFile);
+			PhraseDefer(HelpFile);
 			FirstPass(HelpFile);
 			putc('\n', stderr);
 			if (!external)
@@ -5472,6 +7722,76 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 				ListReferences();
 			}
 			break;
+		case 8: /* write single topic as lookalike RTF to stdout */
+			SysLoad(HelpFile);
+			exportplain = TRUE;
+			TopicsPerRTF = 0;
+			PhraseDefer(HelpFile);
+			BitmapDefer(HelpFile);
+			IndexLoad(HelpFile, IndexFileName);
+			if (!RenderFind(HelpFile, RenderId))
+			{
+				fprintf(stderr, "Topic %s not found.\n", RenderId);
+				break;
+			}
+			FontLoad(HelpFile, stdout, NULL);
+			TopicDump(HelpFile, stdout, NULL, TRUE);
+			putchar('}');
+			break;
+		case 10: /* write plain text */
+			SysLoad(HelpFile);
+			PhraseDefer(HelpFile);
+			TextDump(HelpFile, stdout, TEXT_PLAIN);
+			break;
+		case 11: /* write JSON per topic */
+			SysLoad(HelpFile);
+			PhraseDefer(HelpFile);
+			ContextLoad(HelpFile);
+			TextDump(HelpFile, stdout, TEXT_JSON);
+			break;
+		case 12: /* write full text index */
+			SysLoad(HelpFile);
+			PhraseDefer(HelpFile);
+			StopLoad(HelpFile);
+			topic = WordIndexWrite(HelpFile, WordIndexFileName);
+			if (topic) fprintf(stderr, "%ld words indexed in %s\n", topic, WordIndexFileName);
+			break;
+		case 13: /* query full text index */
+			SysLoad(HelpFile);
+			StopLoad(HelpFile);
+			if (WordQuery(HelpFile, WordIndexFileName, QueryWords) == 0L) printf("No topic contains '%s'.\n", QueryWords);
+			break;
+		case 14: /* look up keywords */
+			SysLoad(HelpFile);
+			IndexLoad(HelpFile, IndexFileName);
+			KeywordFile = HelpFile;
+			d = 'K';
+			ptr = KeywordId;
+			if (ptr[0] && ptr[1] == ':')
+			{
+				sprintf(filename, "|%cWBTREE", ptr[0]);
+				if (SearchFile(HelpFile, filename, NULL))
+				{
+					d = ptr[0];
+					ptr += 2;
+				}
+			}
+			if (ptr[0] == '#')
+			{
+				topic = KeywordLookup(HelpFile, d, NULL, strtol(ptr + 1, NULL, 0), KeywordPrint, &d);
+			}
+			else
+			{
+				topic = KeywordLookup(HelpFile, d, ptr, 0L, KeywordPrint, NULL);
+			}
+			if (!topic) printf("Keyword %s not found.\n", KeywordId);
+			break;
+		case 9: /* write topic index */
+			SysLoad(HelpFile);
+			PhraseDefer(HelpFile);
+			topic = IndexWrite(HelpFile, IndexFileName);
+			if (topic) fprintf(stderr, "%ld topics indexed in %s\n", topic, IndexFileName);
+			break;
 		}
 	}
 	else
@@ -5506,7 +7826,7 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 		else if (strcmp(dumpfile, "|TOPIC") == 0)
 		{
 			SysLoad(HelpFile);
-			PhraseLoad(HelpFile);
+			PhraseDefer(HelpFile);
 			DumpTopic(HelpFile, offset);
 		}
 		else if (strcmp(dumpfile + strlen(dumpfile) - 4, ".grp") == 0)
@@ -5531,114 +7851,658 @@ BOOL HelpDeCompile(FILE* HelpFile, char* dumpfile, int mode, char* exportname, l
 		{
 			SysDump(HelpFile);
 		}
-		else if (strcmp(dumpfile, "|TOMAP") == 0)
+		else if (strcmp(dumpfile, "|TOMAP") == 0)
+		{
+			ToMapDump(HelpFile, FileLength);
+		}
+		else if (strcmp(dumpfile, "|CONTEXT") == 0)
+		{
+			BTreeDump(HelpFile, "ContextId: %h TopicOffset: 0x%08lx\n");
+		}
+		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WBTREE") == 0 || strcmp(dumpfile + 2, "KWBTREE") == 0))
+		{
+			fseek(HelpFile, 7, SEEK_CUR);
+			d = getc(HelpFile);
+			fseek(HelpFile, -8, SEEK_CUR);
+			if (d == '!')
+			{
+				BTreeDump(HelpFile, "Keyword: '%s' Occurrance: %!\n");
+			}
+			else
+			{
+				BTreeDump(HelpFile, "Keyword: '%s' Count: %u KWDataAddress: 0x%08lx\n");
+			}
+		}
+		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WMAP") == 0 || strcmp(dumpfile + 2, "KWMAP") == 0))
+		{
+			KWMapDump(HelpFile);
+		}
+		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WDATA") == 0 || strcmp(dumpfile + 2, "KWDATA") == 0))
+		{
+			KWDataDump(HelpFile, FileLength);
+		}
+		else if (strcmp(dumpfile, "|VIOLA") == 0)
+		{
+			BTreeDump(HelpFile, "TopicOffset: 0x%08lx WindowNumber: %ld\n");
+		}
+		else if (strcmp(dumpfile, "|CTXOMAP") == 0)
+		{
+			CTXOMAPDump(HelpFile);
+		}
+		else if (strcmp(dumpfile, "|CATALOG") == 0)
+		{
+			CatalogDump(HelpFile);
+		}
+		else if (strcmp(dumpfile, "|Petra") == 0)
+		{
+			BTreeDump(HelpFile, "TopicOffset: 0x%08lx SourceFileName: %s\n");
+		}
+		else if (strcmp(dumpfile, "|TopicId") == 0)
+		{
+			BTreeDump(HelpFile, "TopicOffset: 0x%08lx ContextId: %s\n");
+		}
+		else if (strcmp(dumpfile, "|Rose") == 0)
+		{
+			BTreeDump(HelpFile, "KeywordHashValue: 0x%08lx\nMacro: %s\nTitle: %s\n");
+		}
+		else if (strcmp(dumpfile, "|TTLBTREE") == 0)
+		{
+			if (offset)
+			{
+				TitleDump(HelpFile, offset);
+			}
+			else
+			{
+				BTreeDump(HelpFile, "TopicOffset: 0x%08lx TopicTitle: %s\n");
+			}
+		}
+		else if (strcmp(dumpfile, "|FONT") == 0)
+		{
+			FontDump(HelpFile);
+		}
+		else /* generic  */
+		{
+			topic = ftell(HelpFile);
+			if (my_getw(HelpFile) == 0x293B) /* if it's a B+ tree */
+			{
+				my_getw(HelpFile);
+				my_getw(HelpFile);
+				filename[0] = '\0';
+				while ((d = getc(HelpFile)) > 0) /* format according to Structure */
+				{
+					switch (d)
+					{
+					case 'L':
+					case '4':
+					case 'a':
+						strcat(filename, "0x%08lx ");
+						break;
+					case '2':
+						strcat(filename, "%5u ");
+						break;
+					case 'F':
+					case 'i':
+					case 'z':
+						strcat(filename, "'%s' ");
+						break;
+					case '!':
+						strcat(filename, "%!");
+						break;
+					default:
+						error("Unknown Btree field type '%c'", d);
+					}
+				}
+				strcat(filename, "\n");
+				fseek(HelpFile, topic, SEEK_SET);
+				BTreeDump(HelpFile, filename);
+			}
+			else
+			{
+				fseek(HelpFile, topic, SEEK_SET);
+				HexDump(HelpFile, FileLength, offset);
+			}
+		}
+	}
+	return TRUE;
+}
+
+void InitOldTable(void) /* initialize hash value coding oldtable */
+{
+	int i;
+
+	memset(oldtable, 0, sizeof(oldtable));
+	for (i = 0; i < 9; i++) oldtable['1' + i] = i + 1;
+	oldtable['0'] = 10;
+	oldtable['.'] = 12;
+	oldtable['_'] = 13;
+	for (i = 0; i < 26; i++) oldtable['A' + i] = oldtable['a' + i] = 17 + i;
+}
+
+/*********************************************************************************
+
+  LIBRARY INTERFACE
+  =================
+  HelpDecoOpen(..) and the other functions declared in LIBHELPDECO.H give
+  other programs access to a help file without running HELPDECO and reading
+  back the files it writes. They use the same globals as HelpDeCompile, so
+  HelpDecoReset frees and resets those a help file leaves behind before the
+  next one can be opened. Where HELPDECO would end because memory runs out
+  or the help file is damaged, quit returns through QuitJump to the
+  HelpDeco function called, which then fails.
+
+*********************************************************************************/
+
+struct helpdeco
+{
+	FILE* f;
+	BOOL fontsloaded; /* FontLoad done, RTFHeader valid */
+};
+
+static HELPDECO* OpenHelpDeco; /* the only help file open, if any */
+
+/* result = call, or failed if call quits */
+#ifdef HELPDECO_LIBRARY
+#define HELPDECOCALL(result, call, failed) \
+	do \
+	{ \
+		jmp_buf quitjump; \
+		jmp_buf* outer = QuitJump; /* callbacks may call us again */ \
+		if (setjmp(quitjump)) \
+		{ \
+			result = failed; \
+		} \
+		else \
+		{ \
+			QuitJump = &quitjump; \
+			result = call; \
+		} \
+		QuitJump = outer; \
+	} while (0)
+#else
+#define HELPDECOCALL(result, call, failed) result = call
+#endif
+
+/* free and reset what was loaded from the help file */
+static void HelpDecoReset(void)
+{
+	int i;
+
+	TopicFileStart = 0L;
+	LastTopicPos = 0L;
+	PhraseFile = NULL;
+	if (Phrases) free(Phrases);
+	if (PhraseOffsets) free(PhraseOffsets);
+	if (PhraseSpan) free(PhraseSpan);
+	Phrases = NULL;
+	PhraseOffsets = NULL;
+	PhraseSpan = NULL;
+	PhraseCount = 0;
+	if (extension) free(extension);
+	extension = NULL;
+	extensions = 0;
+	for (i = 0; i < windownames; i++) if (windowname[i]) free(windowname[i]);
+	if (windowname) free(windowname);
+	windowname = NULL;
+	windownames = 0;
+	ReferencesFree();
+	memset(lists, 0, sizeof(lists));
+	memset(keyindex, 0, sizeof(keyindex));
+	checkexternal = FALSE;
+	exportplain = FALSE;
+	BitmapFile = NULL;
+	if (bitmaprec) free(bitmaprec);
+	if (bitmapalias) free(bitmapalias);
+	bitmaprec = NULL;
+	bitmapalias = NULL;
+	bitmaprecs = bitmapaliases = 0;
+	if (TopicIndex) free(TopicIndex);
+	if (TopicIndexTitles) free(TopicIndexTitles);
+	TopicIndex = NULL;
+	TopicIndexTitles = NULL;
+	TopicIndexRecs = 0L;
+	if (TitleRec) free(TitleRec);
+	if (TitleStrings) free(TitleStrings);
+	TitleRec = NULL;
+	TitleStrings = NULL;
+	TitleRecs = 0L;
+	if (RTFHeader) free(RTFHeader);
+	RTFHeader = NULL;
+	RTFHeaderLength = RTFHeaderSize = 0L;
+	if (font) free(font);
+	font = NULL;
+	fontname = NULL; /* freed by FontLoad */
+	fonts = fontnames = colors = 0;
+	if (Topic) free(Topic);
+	if (TopicNext) free(TopicNext);
+	Topic = NULL;
+	TopicNext = NULL;
+	Topics = 0;
+	if (ContextRec) free(ContextRec);
+	ContextRec = NULL;
+	ContextRecs = 0;
+	for (i = 0; i < hashrecs; i++) free(hashrec[i].name);
+	if (hashrec) free(hashrec);
+	hashrec = NULL;
+	hashrecs = 0;
+	if (KeywordRec)
+	{
+		for (i = 0; i < KeywordRecs; i++) if (KeywordRec[i].Keyword) free(KeywordRec[i].Keyword);
+		free(KeywordRec);
+	}
+	KeywordRec = NULL;
+	NextKeywordRec = KeywordRecs = 0;
+	NextKeywordOffset = 0L;
+	if (browse) free(browse);
+	browse = NULL;
+	browses = browsenums = 0;
+	if (Viola) free(Viola);
+	Viola = NULL;
+	VIOLAfound = -1;
+	RenderTopic = 0L;
+	RenderPos = 0L;
+	RenderOffset = 0L;
+}
+
+static HELPDECO* HelpDecoAttach(FILE* f)
+{
+	HELPDECO* hd;
+
+	if (!SearchFile(f, NULL, NULL) || !SearchFile(f, "|SYSTEM", NULL)) return NULL;
+	InitOldTable();
+	SysLoad(f);
+	PhraseDefer(f);
+	exportplain = TRUE; /* render as -r does */
+	BitmapDefer(f);
+	hd = my_malloc(sizeof(HELPDECO));
+	hd->f = f;
+	hd->fontsloaded = FALSE;
+	OpenHelpDeco = hd;
+	return hd;
+}
+
+HELPDECO* HelpDecoOpen(const char* filename)
+{
+	HELPDECO* hd;
+	FILE* f;
+
+	if (OpenHelpDeco) return NULL;
+	_splitpath(filename, NULL, NULL, name, ext);
+	if (ext[0] == '\0') strcpy(ext, ".hlp");
+	mvp = toupper((unsigned char)ext[1]) == 'M';
+	strlcpy(HelpFileName, filename, sizeof(HelpFileName));
+	f = fopen(filename, "rb");
+	if (!f) return NULL;
+	HELPDECOCALL(hd, HelpDecoAttach(f), NULL);
+	if (!hd)
+	{
+		fclose(f);
+		HelpDecoReset();
+	}
+	return hd;
+}
+
+HELPDECO* HelpDecoOpenMemory(const void* data, long size)
+{
+	HELPDECO* hd;
+	FILE* f;
+
+	if (OpenHelpDeco) return NULL;
+	strcpy(name, "helpfile");
+	strcpy(ext, ".hlp");
+	strcpy(HelpFileName, "helpfile.hlp");
+	mvp = FALSE;
+#ifdef _WIN32
+	f = tmpfile();
+	if (f && fwrite(data, 1, size, f) != (size_t)size)
+	{
+		fclose(f);
+		f = NULL;
+	}
+#else
+	f = fmemopen((void*)data, size, "rb");
+#endif
+	if (!f) return NULL;
+	HELPDECOCALL(hd, HelpDecoAttach(f), NULL);
+	if (!hd)
+	{
+		fclose(f);
+		HelpDecoReset();
+	}
+	return hd;
+}
+
+void HelpDecoClose(HELPDECO* hd)
+{
+	if (!hd || hd != OpenHelpDeco) return;
+	fclose(hd->f);
+	free(hd);
+	OpenHelpDeco = NULL;
+	HelpDecoReset();
+}
+
+static int HelpDecoFileList(HELPDECO* hd, HELPDECOFILEPROC proc, void* ctx)
+{
+	BUFFER buf;
+	FILEHEADER FileHdr;
+	char FileName[NAME_MAX];
+	long offset, savepos;
+	int i, n;
+
+	SearchFile(hd->f, NULL, NULL);
+	for (n = GetFirstPage(hd->f, &buf, NULL); n; n = GetNextPage(hd->f, &buf))
+	{
+		for (i = 0; i < n; i++)
+		{
+			my_gets(FileName, sizeof(FileName), hd->f);
+			offset = getdw(hd->f);
+			savepos = ftell(hd->f);
+			fseek(hd->f, offset, SEEK_SET);
+			read_FILEHEADER(&FileHdr, hd->f);
+			if (!proc(ctx, FileName, FileHdr.UsedSpace)) return 0;
+			fseek(hd->f, savepos, SEEK_SET);
+		}
+	}
+	return 1;
+}
+
+int HelpDecoFiles(HELPDECO* hd, HELPDECOFILEPROC proc, void* ctx)
+{
+	int result;
+
+	HELPDECOCALL(result, HelpDecoFileList(hd, proc, ctx), 0);
+	return result;
+}
+
+static long HelpDecoTopicList(HELPDECO* hd, HELPDECOTOPICPROC proc, void* ctx)
+{
+	TOPICLINK TopicLink;
+	char* LinkData1;
+	char* LinkData2;
+	char* ptr;
+	long TopicPos, TopicNum, TopicOffset;
+
+	if (!SearchFile(hd->f, "|TOPIC", &TopicFileLength)) return 0L;
+	TopicOffset = 0L;
+	TopicPos = 12L;
+	TopicNum = 0L;
+	while (TopicRead(hd->f, TopicPos, &TopicLink, sizeof(TopicLink)) == sizeof(TOPICLINK))
+	{
+		if (before31)
+		{
+			if (TopicPos + TopicLink.NextBlock >= TopicFileLength) break;
+		}
+		else
 		{
-			ToMapDump(HelpFile, FileLength);
+			if (TopicLink.NextBlock <= 0) break;
 		}
-		else if (strcmp(dumpfile, "|CONTEXT") == 0)
+		if (TopicLink.DataLen1 > sizeof(TOPICLINK))
 		{
-			BTreeDump(HelpFile, "ContextId: %h TopicOffset: 0x%08lx\n");
+			LinkData1 = TopicView(hd->f, 0L, TopicLink.DataLen1 - sizeof(TOPICLINK), TopicLink.BlockSize - sizeof(TOPICLINK));
+			if (!LinkData1) break;
 		}
-		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WBTREE") == 0 || strcmp(dumpfile + 2, "KWBTREE") == 0))
+		else LinkData1 = NULL;
+		if (LinkData1 && TopicLink.RecordType == TL_TOPICHDR)
 		{
-			fseek(HelpFile, 7, SEEK_CUR);
-			d = getc(HelpFile);
-			fseek(HelpFile, -8, SEEK_CUR);
-			if (d == '!')
+			LinkData2 = NULL;
+			if (TopicLink.DataLen1 < TopicLink.BlockSize) /* title is the first string of LinkData2 */
 			{
-				BTreeDump(HelpFile, "Keyword: '%s' Occurrance: %!\n");
+				LinkData2 = ArenaAlloc(&LinkArena, TopicLink.DataLen2 + 1);
+				if (TopicPhraseRead(hd->f, 0L, LinkData2, TopicLink.BlockSize - TopicLink.DataLen1, TopicLink.DataLen2) != TopicLink.BlockSize - TopicLink.DataLen1) break;
 			}
-			else
+			TopicNum++;
+			if (!proc(ctx, TopicNum, before31 ? TopicPos : TopicOffset, LinkData2 ? LinkData2 : ""))
 			{
-				BTreeDump(HelpFile, "Keyword: '%s' Count: %u KWDataAddress: 0x%08lx\n");
+				ArenaReset(&LinkArena);
+				break;
 			}
 		}
-		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WMAP") == 0 || strcmp(dumpfile + 2, "KWMAP") == 0))
-		{
-			KWMapDump(HelpFile);
-		}
-		else if (dumpfile[0] == '|' && (strcmp(dumpfile + 2, "WDATA") == 0 || strcmp(dumpfile + 2, "KWDATA") == 0))
-		{
-			KWDataDump(HelpFile, FileLength);
-		}
-		else if (strcmp(dumpfile, "|VIOLA") == 0)
-		{
-			BTreeDump(HelpFile, "TopicOffset: 0x%08lx WindowNumber: %ld\n");
-		}
-		else if (strcmp(dumpfile, "|CTXOMAP") == 0)
-		{
-			CTXOMAPDump(HelpFile);
-		}
-		else if (strcmp(dumpfile, "|CATALOG") == 0)
-		{
-			CatalogDump(HelpFile);
-		}
-		else if (strcmp(dumpfile, "|Petra") == 0)
+		else if (LinkData1 && (TopicLink.RecordType == TL_DISPLAY || TopicLink.RecordType == TL_TABLE))
 		{
-			BTreeDump(HelpFile, "TopicOffset: 0x%08lx SourceFileName: %s\n");
+			ptr = LinkData1;
+			scanlong(&ptr);
+			TopicOffset += scanword(&ptr);
 		}
-		else if (strcmp(dumpfile, "|TopicId") == 0)
+		ArenaReset(&LinkArena); /* LinkData1 and LinkData2 */
+		if (before31)
 		{
-			BTreeDump(HelpFile, "TopicOffset: 0x%08lx ContextId: %s\n");
+			TopicPos += TopicLink.NextBlock;
 		}
-		else if (strcmp(dumpfile, "|Rose") == 0)
+		else
 		{
-			BTreeDump(HelpFile, "KeywordHashValue: 0x%08lx\nMacro: %s\nTitle: %s\n");
+			TopicOffset = NextTopicOffset(TopicOffset, TopicLink.NextBlock, TopicPos);
+			TopicPos = TopicLink.NextBlock;
 		}
-		else if (strcmp(dumpfile, "|TTLBTREE") == 0)
+	}
+	return TopicNum;
+}
+
+long HelpDecoTopics(HELPDECO* hd, HELPDECOTOPICPROC proc, void* ctx)
+{
+	long topics;
+
+	HELPDECOCALL(topics, HelpDecoTopicList(hd, proc, ctx), 0L);
+	return topics;
+}
+
+/* write topic selected by RenderTopic (and RenderPos) as lookalike RTF
+// into a buffer allocated by malloc */
+static char* HelpDecoDump(HELPDECO* hd, long* length)
+{
+	FILE* rtf;
+	char* result;
+	size_t size;
+
+	result = NULL;
+	size = 0;
+#ifdef _WIN32
+	rtf = tmpfile();
+#else
+	rtf = open_memstream(&result, &size);
+#endif
+	if (rtf)
+	{
+		if (hd->fontsloaded)
 		{
-			BTreeDump(HelpFile, "TopicOffset: 0x%08lx TopicTitle: %s\n");
+			FontHeader(rtf);
 		}
-		else if (strcmp(dumpfile, "|FONT") == 0)
+		else
 		{
-			FontDump(HelpFile);
-		}
-		else /* generic  */
+			FontLoad(hd->f, rtf, NULL);
+			hd->fontsloaded = TRUE;
+		}
+		rtf = TopicDump(hd->f, rtf, NULL, TRUE);
+		putc('}', rtf);
+#ifdef _WIN32
+		size = ftell(rtf);
+		result = my_malloc(size + 1);
+		rewind(rtf);
+		size = fread(result, 1, size, rtf);
+		result[size] = '\0';
+#endif
+		fclose(rtf);
+		if (length) *length = (long)size;
+	}
+	RenderTopic = 0L;
+	RenderPos = 0L;
+	return result;
+}
+
+static char* HelpDecoRenderTopic(HELPDECO* hd, long topicnum, long* length)
+{
+	TOPICOFFSET TopicOffset;
+
+	if (topicnum < 1L) return NULL;
+	if (topicnum <= TopicIndexRecs) /* start right at the topic */
+	{
+		RenderPos = TopicIndex[topicnum - 1].Pos;
+		RenderOffset = TopicIndex[topicnum - 1].Offset;
+		RenderTopic = 1L;
+	}
+	else if (CatalogOffset(hd->f, topicnum, &TopicOffset) && TopicStart(hd->f, TopicOffset, &RenderPos, &RenderOffset))
+	{
+		RenderTopic = 1L;
+	}
+	else
+	{
+		RenderTopic = topicnum;
+	}
+	return HelpDecoDump(hd, length);
+}
+
+char* HelpDecoRender(HELPDECO* hd, long topicnum, long* length)
+{
+	char* result;
+
+	HELPDECOCALL(result, HelpDecoRenderTopic(hd, topicnum, length), NULL);
+	return result;
+}
+
+static char* HelpDecoRenderId(HELPDECO* hd, const char* contextid, long* length)
+{
+	char id[256];
+
+	strlcpy(id, contextid, sizeof(id));
+	if (!RenderFind(hd->f, id)) return NULL;
+	return HelpDecoDump(hd, length);
+}
+
+char* HelpDecoRenderContext(HELPDECO* hd, const char* contextid, long* length)
+{
+	char* result;
+
+	HELPDECOCALL(result, HelpDecoRenderId(hd, contextid, length), NULL);
+	return result;
+}
+
+static char* HelpDecoRenderAt(HELPDECO* hd, long topicoffset, long* length)
+{
+	if (!TopicStart(hd->f, topicoffset, &RenderPos, &RenderOffset)) return NULL;
+	RenderTopic = 1L;
+	return HelpDecoDump(hd, length);
+}
+
+char* HelpDecoRenderOffset(HELPDECO* hd, long topicoffset, long* length)
+{
+	char* result;
+
+	HELPDECOCALL(result, HelpDecoRenderAt(hd, topicoffset, length), NULL);
+	return result;
+}
+
+static long HelpDecoIndex(HELPDECO* hd, const char* filename)
+{
+	long topics;
+
+	topics = IndexWrite(hd->f, filename);
+	if (topics && !TopicIndexRecs) IndexLoad(hd->f, filename);
+	return topics;
+}
+
+long HelpDecoWriteIndex(HELPDECO* hd, const char* filename)
+{
+	BOOL overwrite;
+	long topics;
+
+	overwrite = overwriteFile;
+	overwriteFile = TRUE;
+	HELPDECOCALL(topics, HelpDecoIndex(hd, filename), 0L);
+	overwriteFile = overwrite;
+	return topics;
+}
+
+long HelpDecoLoadIndex(HELPDECO* hd, const char* filename)
+{
+	BOOL loaded;
+
+	if (TopicIndexRecs) return 0L;
+	HELPDECOCALL(loaded, IndexLoad(hd->f, filename), FALSE);
+	return loaded ? TopicIndexRecs : 0L;
+}
+
+char* HelpDecoTitle(HELPDECO* hd, long topicoffset)
+{
+	char* title;
+
+	HELPDECOCALL(title, TitleLookup(hd->f, topicoffset), NULL);
+	return title;
+}
+
+long HelpDecoLoadTitles(HELPDECO* hd)
+{
+	long titles;
+
+	HELPDECOCALL(titles, TitleLoad(hd->f), 0L);
+	return titles;
+}
+
+long HelpDecoKeywords(HELPDECO* hd, int list, const char* prefix, HELPDECOKEYWORDPROC proc, void* ctx)
+{
+	long keywords;
+
+	HELPDECOCALL(keywords, KeywordLookup(hd->f, list ? list : 'K', prefix ? prefix : "", 0L, proc, ctx), 0L);
+	return keywords;
+}
+
+long HelpDecoKeywordsAt(HELPDECO* hd, int list, long keywordnum, HELPDECOKEYWORDPROC proc, void* ctx)
+{
+	long keywords;
+
+	HELPDECOCALL(keywords, KeywordLookup(hd->f, list ? list : 'K', NULL, keywordnum, proc, ctx), 0L);
+	return keywords;
+}
+
+static int HelpDecoBitmapList(HELPDECO* hd, HELPDECOBITMAPPROC proc, void* ctx)
+{
+	BUFFER buf;
+	FILEHEADER FileHdr;
+	char FileName[NAME_MAX];
+	char* leader;
+	char* image;
+	long offset, savepos, imagesize;
+	int i, n, result;
+
+	leader = "|bm" + before31;
+	image = NULL;
+	imagesize = 0L;
+	result = 1;
+	SearchFile(hd->f, NULL, NULL);
+	for (n = GetFirstPage(hd->f, &buf, NULL); n && result; n = GetNextPage(hd->f, &buf))
+	{
+		for (i = 0; i < n && result; i++)
 		{
-			topic = ftell(HelpFile);
-			if (my_getw(HelpFile) == 0x293B) /* if it's a B+ tree */
+			my_gets(FileName, sizeof(FileName), hd->f);
+			offset = getdw(hd->f);
+			if (memcmp(FileName, leader, strlen(leader)) == 0)
 			{
-				my_getw(HelpFile);
-				my_getw(HelpFile);
-				filename[0] = '\0';
-				while ((d = getc(HelpFile)) > 0) /* format according to Structure */
+				savepos = ftell(hd->f);
+				fseek(hd->f, offset, SEEK_SET);
+				read_FILEHEADER(&FileHdr, hd->f);
+				if (FileHdr.UsedSpace > imagesize)
 				{
-					switch (d)
-					{
-					case 'L':
-					case '4':
-					case 'a':
-						strcat(filename, "0x%08lx ");
-						break;
-					case '2':
-						strcat(filename, "%5u ");
-						break;
-					case 'F':
-					case 'i':
-					case 'z':
-						strcat(filename, "'%s' ");
-						break;
-					case '!':
-						strcat(filename, "%!");
-						break;
-					default:
-						error("Unknown Btree field type '%c'", d);
-					}
+					image = my_realloc(image, FileHdr.UsedSpace);
+					imagesize = FileHdr.UsedSpace;
 				}
-				strcat(filename, "\n");
-				fseek(HelpFile, topic, SEEK_SET);
-				BTreeDump(HelpFile, filename);
-			}
-			else
-			{
-				fseek(HelpFile, topic, SEEK_SET);
-				HexDump(HelpFile, FileLength, offset);
+				if (my_fread(image, FileHdr.UsedSpace, hd->f) == (size_t)FileHdr.UsedSpace)
+				{
+					result = proc(ctx, atoi(FileName + (FileName[0] == '|') + 2), FileName + (FileName[0] == '|'), image, FileHdr.UsedSpace);
+				}
+				fseek(hd->f, savepos, SEEK_SET);
 			}
 		}
 	}
-	return TRUE;
+	if (image) free(image);
+	return result;
+}
+
+int HelpDecoBitmaps(HELPDECO* hd, HELPDECOBITMAPPROC proc, void* ctx)
+{
+	int result;
+
+	HELPDECOCALL(result, HelpDecoBitmapList(hd, proc, ctx), 0);
+	return result;
 }
 
+#ifndef HELPDECO_LIBRARY
 int main(int argc, char* argv[])
 {
 	char AnnoFileName[NAME_MAX];
@@ -5650,16 +8514,14 @@ int main(int argc, char* argv[])
 	char* filename;
 	char* dumpfile;
 	char* exportname;
+	char* format;
 	long offset;
+	double wall, cpu;
+	BOOL usage;
 	int i, j;
 
-	/* initialize hash value coding oldtable */
-	memset(oldtable, 0, sizeof(oldtable));
-	for (i = 0; i < 9; i++) oldtable['1' + i] = i + 1;
-	oldtable['0'] = 10;
-	oldtable['.'] = 12;
-	oldtable['_'] = 13;
-	for (i = 0; i < 26; i++) oldtable['A' + i] = oldtable['a' + i] = 17 + i;
+	InitOldTable();
+	usage = FALSE;
 	exportname = dumpfile = filename = NULL;
 	AnnoFileName[0] = '\0';
 	mode = 0;
@@ -5672,6 +8534,20 @@ int main(int argc, char* argv[])
 		{
 			switch (tolower((unsigned char)argv[i][1]))
 			{
+			case '-':
+				if (stricmp(argv[i] + 2, "stats") == 0)
+				{
+					stats = 1;
+				}
+				else if (stricmp(argv[i] + 2, "stats=json") == 0)
+				{
+					stats = 2;
+				}
+				else
+				{
+					fprintf(stderr, "unknown option '%s' ignored\n", argv[i]);
+				}
+				break;
 			case 'a':
 				if (argv[i][2])
 				{
@@ -5724,6 +8600,38 @@ int main(int argc, char* argv[])
 			case 'i':
 				reportderived = TRUE;
 				break;
+			case 'j':
+				if (argv[i][2])
+				{
+					RenderId = argv[i] + 2;
+				}
+				else if (argv[i + 1] && argv[i + 1][0] != '/' && argv[i + 1][0] != '-')
+				{
+					RenderId = argv[i + 1];
+					i++;
+				}
+				else
+				{
+					usage = TRUE; /* context id missing */
+				}
+				if (RenderId) mode = 8;
+				break;
+			case 'k':
+				if (argv[i][2])
+				{
+					KeywordId = argv[i] + 2;
+				}
+				else if (argv[i + 1] && argv[i + 1][0] != '/' && argv[i + 1][0] != '-')
+				{
+					KeywordId = argv[i + 1];
+					i++;
+				}
+				else
+				{
+					usage = TRUE; /* keyword prefix missing */
+				}
+				if (KeywordId) mode = 14;
+				break;
 			case 'l':
 				mode = 5;
 				break;
@@ -5736,9 +8644,62 @@ int main(int argc, char* argv[])
 			case 'p':
 				mode = 6;
 				break;
+			case 'q':
+				if (argv[i][2])
+				{
+					QueryWords = argv[i] + 2;
+				}
+				else if (argv[i + 1] && argv[i + 1][0] != '/' && argv[i + 1][0] != '-')
+				{
+					QueryWords = argv[i + 1];
+					i++;
+				}
+				else
+				{
+					usage = TRUE; /* words missing */
+				}
+				if (QueryWords) mode = 13;
+				break;
 			case 'r':
 				mode = 3;
 				break;
+			case 'u':
+				uniquebitmaps = TRUE;
+				break;
+			case 'o':
+				if (argv[i][2])
+				{
+					format = argv[i] + 2;
+				}
+				else if (argv[i + 1] && (strcmp(argv[i + 1], "text") == 0 || strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "index") == 0))
+				{
+					format = argv[i + 1];
+					i++;
+				}
+				else
+				{
+					format = "text";
+				}
+				if (strcmp(format, "text") == 0)
+				{
+					mode = 10;
+				}
+				else if (strcmp(format, "json") == 0)
+				{
+					mode = 11;
+				}
+				else if (strcmp(format, "index") == 0)
+				{
+					mode = 12;
+				}
+				else
+				{
+					fprintf(stderr, "unknown output format '%s' ignored\n", format);
+				}
+				break;
+			case 'w':
+				mode = 9;
+				break;
 			case 's':
 				if (argv[i][2])
 				{
@@ -5791,12 +8752,16 @@ int main(int argc, char* argv[])
 			filename = argv[i];
 		}
 	}
-	if (filename)
+	if (filename && !usage)
 	{
+		wall = WallTime();
+		cpu = (double)clock() / CLOCKS_PER_SEC;
 		_splitpath(filename, drive, dir, name, ext);
 		if (ext[0] == '\0') strcpy(ext, ".hlp");
 		mvp = toupper(ext[1]) == 'M';
 		_makepath(HelpFileName, drive, dir, name, ext);
+		_makepath(IndexFileName, drive, dir, name, ".hdx");
+		_makepath(WordIndexFileName, drive, dir, name, ".hdw");
 		f = fopen(HelpFileName, "rb");
 		if (f)
 		{
@@ -5818,6 +8783,7 @@ int main(int argc, char* argv[])
 			{
 				fprintf(stderr, "%s isn't a valid WinHelp file !\n", HelpFileName);
 			}
+			if (stats) StatsReport(wall, cpu);
 			if (annotate && AnnoFile) fclose(AnnoFile);
 			my_fclose(f);
 		}
@@ -5836,6 +8802,12 @@ int main(int argc, char* argv[])
 			"         HELPDECO helpfile[.hlp] "OPTSTR"r ["OPTSTR"y] ["OPTSTR"n]    - decompile into lookalike RTF\n"
 			"         HELPDECO helpfile[.hlp] "OPTSTR"c ["OPTSTR"y]  - generate Win95 .CNT content file\n"
 			"         HELPDECO helpfile[.hlp] "OPTSTR"l       - list entry points of this helpfile\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"j contextid|#hash|+offset - write topic as RTF\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"w       - write topic index helpfile.hdx for "OPTSTR"j\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"o [text|json] - write titles and text of all topics\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"o index - write full text index helpfile.hdw\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"q \"words\" - list topics containing words\n"
+			"         HELPDECO helpfile[.hlp] "OPTSTR"k [A:]prefix|#n - list keywords and their topics\n"
 			"         HELPDECO helpfile[.hlp] "OPTSTR"e ["OPTSTR"f]  - list references to other helpfiles\n"
 			"         HELPDECO helpfile[.hlp] "OPTSTR"p ["OPTSTR"f]  - check references to other helpfiles\n"
 			"         HELPDECO helpfile[.hlp] "OPTSTR"d ["OPTSTR"x]  - display internal directory\n"
@@ -5843,6 +8815,7 @@ int main(int argc, char* argv[])
 			"         HELPDECO helpfile[.hlp] \"internalfile\" filename - export internal file\n"
 			"options: "OPTSTR"y overwrite without warning, "OPTSTR"f list referencing topics, "OPTSTR"x hex dump\n"
 			"         "OPTSTR"g no guessing, "OPTSTR"hprefix add known contextid prefix, "OPTSTR"n no page breaks\n"
+			"         "OPTSTR"u write identical bitmaps only once, "OPTSTR"-stats[=json] report time per phase\n"
 			"To recreate all source files necessary to rebuild a Windows helpfile, create\n"
 			"a directory, change to this directory and call HELPDECO with the path and name\n"
 			"of the helpfile to dissect. HELPDECO will extract all files contained in the\n"
@@ -5856,3 +8829,4 @@ int main(int argc, char* argv[])
 	}
 	return 0;
 }
+#endif
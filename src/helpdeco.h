@@ -31,6 +31,9 @@ http://www.gnu.org
 #endif  
 #include <stdio.h>
 #include <stdarg.h>
+#ifdef HELPDECO_LIBRARY
+#include <setjmp.h>
+#endif
 #ifndef _WIN32
 #include <stdint.h>
 #endif
@@ -666,13 +669,15 @@ KEYWORDREC;
 typedef struct placerec       /* internal use to store external references */
 {
 	struct placerec* next;
-	char topicname[1];
+	char* topicname;              /* shared by places in the same topic */
 }
 PLACEREC;
 
 typedef struct checkrec       /* internal use to store external references */
 {
 	struct checkrec* next;
+	struct checkrec* hashnext;    /* in bucket of checkrechash */
+	struct fileref* file;
 	enum { TOPIC, CONTEXT } type;
 	int32_t hash;
 	char* id;
@@ -683,11 +688,83 @@ CHECKREC;
 typedef struct fileref        /* internal use to store external references */
 {
 	struct fileref* next;
+	struct fileref* hashnext;     /* in bucket of filerefhash */
 	CHECKREC* check;
+	char* key;                    /* normalized filename, see FileNameKey */
+	unsigned int keyhash;         /* FileNameKey value of key */
 	char filename[1];
 }
 FILEREF;
 
+typedef struct                /* internal use: annotation file directory entry */
+{
+	long pos;                     /* TopicPos annotated */
+	long offset;                  /* of FILEHEADER in annotation file */
+}
+ANNOREC;
+
+typedef struct                /* internal use to find identical bitmaps */
+{
+	uint32_t hash;
+	long offset;                  /* of image data in help file */
+	long length;
+	long exported;                /* size of written file */
+	int num;
+	int next;                     /* next record in same BitmapHash bucket or -1 */
+}
+BITMAPREC;
+
+typedef struct                /* internal use: topic index entry, see IndexWrite */
+{
+	TOPICPOS Pos;                 /* of Topic Header */
+	TOPICPOS End;                 /* of next Topic Header */
+	TOPICOFFSET Offset;           /* at Topic Header */
+	uint32_t Title;               /* offset into TopicIndexTitles */
+}
+TOPICINDEXREC;
+
+typedef struct                /* internal use: jump or popup of topic written by -o json */
+{
+	BOOL popup;
+	char* target;                 /* context id */
+	char* window;                 /* secondary window or NULL */
+	char* file;                   /* external help file or NULL */
+}
+JSONLINKREC;
+
+typedef struct                /* internal use: topic title preloaded by TitleLoad */
+{
+	TOPICOFFSET TopicOffset;
+	uint32_t Title;               /* offset into TitleStrings */
+}
+TITLEREC;
+
+typedef struct                /* internal use: word of full text index, see WordIndexWrite */
+{
+	char* name;
+	int32_t next;                 /* next word in same WordHash bucket or -1 */
+	uint32_t count;               /* number of occurrences */
+	uint32_t topics;              /* number of topics containing word */
+	uint32_t lasttopic;           /* topic of last occurrence + 1 */
+	uint32_t first;               /* first posting in index file */
+}
+WORDREC;
+
+typedef struct                /* internal use: occurrence of a word in a topic */
+{
+	uint32_t word;
+	uint32_t topic;
+	uint32_t pos;                 /* number of words in topic before this one */
+}
+WORDPOSREC;
+
+typedef struct                /* internal use: location of a loaded phrase */
+{
+	char* ptr;
+	unsigned int len;
+}
+PHRASESPAN;
+
 typedef struct                /* internal use */
 {
 	TOPICOFFSET TopicOffset;
@@ -698,6 +775,7 @@ ALTERNATIVE;
 typedef struct mfile          /* a class would be more appropriate */
 {
 	FILE* f;
+	char* start;
 	char* ptr;
 	char* end;
 	int (*get)(struct mfile*);
@@ -708,7 +786,60 @@ typedef struct mfile          /* a class would be more appropriate */
 }
 MFILE;
 
+typedef struct arenachunk     /* internal use: overflow block of an ARENA */
+{
+	struct arenachunk* next;
+	double align;             /* allocations start here */
+}
+ARENACHUNK;
+
+typedef struct                /* internal use: scratch memory released as a whole */
+{
+	char* base;
+	long size;
+	long used;
+	long overflow;
+	ARENACHUNK* chunks;
+	char* spare;              /* unused rest of newest chunk */
+	long spareleft;
+}
+ARENA;
+
+typedef struct                /* internal use: counters reported by option --stats */
+{
+	long BytesRead;           /* by my_fread, my_gets, my_getw and FileGet */
+	long SearchFiles;         /* calls of SearchFile */
+	long BTreePages;          /* B+ tree node headers read */
+	long Blocks;              /* calls of decompress */
+	long Decompressed;        /* bytes produced by decompress */
+	long Phrases;             /* phrases expanded by CopyPhrase */
+	long Mallocs;             /* calls of my_malloc and my_realloc */
+	long MallocBytes;         /* bytes requested by them */
+	long Written;             /* size of files closed by my_fclose */
+}
+STATS;
+
+typedef struct                /* internal use: one phase of --stats report */
+{
+	const char* name;
+	double wall;              /* seconds */
+	double cpu;
+	STATS count;
+}
+STATSPHASE;
+
+typedef struct                /* internal use: field of BTreeDump text */
+{
+	char type;                /* '\0' literal, 'h', 's', '!', 'l' dword, 'w' word */
+	char format[10];          /* printf format of the field */
+	const char* text;         /* literal text */
+	int len;
+}
+BTREEFIELD;
+
 extern void error(const char* format, ...);
+extern void progress(const char* format, ...); /* not shown by the library */
+extern void quit(int status); /* give up, exit or fail the library call */
 #ifdef HAVE_STRNCPY
 #define strlcpy strncpy
 #elif !defined(HAVE_STRLCPY)
@@ -726,6 +857,9 @@ extern size_t strlcpy(char* dest, const char* src, size_t len); /* limited strin
 extern void* my_malloc(long bytes); /* save malloc function */
 extern void* my_realloc(void* ptr, long bytes); /* save realloc function */
 extern char* my_strdup(const char* ptr); /* save strdup function */
+extern void* ArenaAlloc(ARENA* a, long bytes); /* get scratch memory from arena */
+extern void ArenaReset(ARENA* a); /* release all memory taken from arena */
+extern void ArenaFree(ARENA* a); /* release all memory of arena, keeping none for reuse */
 extern size_t my_fread(void* ptr, long bytes, FILE* f); /* save fread function */
 extern size_t my_gets(char* ptr, size_t size, FILE* f);  /* read nul terminated string from regular file */
 extern void my_fclose(FILE* f); /* checks if disk is full */
@@ -762,8 +896,8 @@ extern long DecompressIntoFile(int method, MFILE* f, long bytes, FILE* fTarget);
 extern void HexDump(FILE* f, long FileLength, long offset);
 extern void HexDumpMemory(unsigned char* bypMem, unsigned int FileLength);
 extern char* PrintString(const char* str, unsigned int len);
-extern BOOL GetBit(FILE* f);
 extern void putrtf(FILE* rtf, const char* str);
+extern void putjson(FILE* f, const char* str, long len);
 extern int16_t scanint(char** ptr); /* scan a compressed short */
 extern uint16_t scanword(char** ptr); /* scan a compressed unsiged short */
 extern uint32_t scanlong(char** ptr);  /* scan a compressed long */
@@ -786,4 +920,9 @@ extern void LinkDump(FILE* HelpFile);
 extern void AnnotationDump(FILE* HelpFile, long FileLength, const char* name);
 
 extern BOOL overwriteFile; /* ugly: declared in HELPDECO.C */
+extern int stats;
+extern STATS Stats;
+#ifdef HELPDECO_LIBRARY
+extern jmp_buf* QuitJump; /* where quit goes in the library, see HELPDECO.C */
+#endif
 #endif
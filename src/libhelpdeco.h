@@ -0,0 +1,108 @@
+/*
+helpdeco -- utility program to dissect Windows help files
+Copyright (C) 1997 Manfred Winterhoff
+Copyright (C) 2001 Ben Collver
+
+This file is part of helpdeco; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 59 Temple Place, Suite 330, Boston, MA, 02111-1307, USA or visit:
+http://www.gnu.org
+*/
+
+/* LIBHELPDECO.H - interface of libhelpdeco, built from HELPDECO.C and
+// HELPDEC1.C with HELPDECO_LIBRARY defined (make lib).
+// The decompiler keeps its state in globals, so only one help file may be
+// open at a time; HelpDecoClose frees it so the next one can be opened.
+// Diagnostics still go to stderr, but error() never waits for a key press
+// and no progress is reported. If memory runs out or the help file is
+// damaged, the function called returns NULL or 0 and the help file should
+// be closed */
+#ifndef LIBHELPDECO_H
+#define LIBHELPDECO_H
+
+/* libhelpdeco is built with hidden visibility, only these are exported */
+#if defined(HELPDECO_LIBRARY) && defined(__GNUC__)
+#define HELPDECOAPI __attribute__((visibility("default")))
+#else
+#define HELPDECOAPI
+#endif
+
+typedef struct helpdeco HELPDECO; /* open help file, see HelpDecoOpen */
+
+/* callbacks return 0 to stop the enumeration, anything else to continue */
+typedef int (*HELPDECOFILEPROC)(void* ctx, const char* name, long size);
+typedef int (*HELPDECOTOPICPROC)(void* ctx, long topicnum, long topicoffset, const char* title);
+typedef int (*HELPDECOBITMAPPROC)(void* ctx, int num, const char* name, const void* data, long size);
+typedef int (*HELPDECOKEYWORDPROC)(void* ctx, long keywordnum, const char* keyword, int topics, const long* topicoffset);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* open help file (.HLP or .MVB) by name or from size bytes at data, which
+// must stay valid until HelpDecoClose. Returns NULL if it isn't a valid
+// help file or another one is still open */
+extern HELPDECOAPI HELPDECO* HelpDecoOpen(const char* filename);
+extern HELPDECOAPI HELPDECO* HelpDecoOpenMemory(const void* data, long size);
+extern HELPDECOAPI void HelpDecoClose(HELPDECO* hd);
+
+/* call proc for each internal file with its name and size */
+extern HELPDECOAPI int HelpDecoFiles(HELPDECO* hd, HELPDECOFILEPROC proc, void* ctx);
+
+/* call proc for each topic with its number (1 = first), topic offset
+// (as used by |CONTEXT) and title, returns number of topics seen */
+extern HELPDECOAPI long HelpDecoTopics(HELPDECO* hd, HELPDECOTOPICPROC proc, void* ctx);
+
+/* render topic topicnum as lookalike RTF (like -r does for all topics)
+// into a buffer allocated by malloc, storing its length in *length.
+// The topic is found through the topic index, |CATALOG or |TOMAP, else
+// all topics before it are read. Pictures are referenced by the file
+// names -r would give them */
+extern HELPDECOAPI char* HelpDecoRender(HELPDECO* hd, long topicnum, long* length);
+
+/* render the topic found by context id (or #hash value) through |CONTEXT,
+// or the topic containing topic offset, reading only the topic blocks
+// from the one the topic offset points into (like option -j) */
+extern HELPDECOAPI char* HelpDecoRenderContext(HELPDECO* hd, const char* contextid, long* length);
+extern HELPDECOAPI char* HelpDecoRenderOffset(HELPDECO* hd, long topicoffset, long* length);
+
+/* write topic index (like option -w) to filename, or load it, so that
+// rendering seeks to the topic directly. Return number of topics indexed */
+extern HELPDECOAPI long HelpDecoWriteIndex(HELPDECO* hd, const char* filename);
+extern HELPDECOAPI long HelpDecoLoadIndex(HELPDECO* hd, const char* filename);
+
+/* title of the topic containing topicoffset, NULL if not found. The title
+// is found in |TTLBTREE by descending its index pages, unless all titles
+// were loaded by HelpDecoLoadTitles (which returns their number) for many
+// lookups. The title stays valid until the next call or HelpDecoClose */
+extern HELPDECOAPI char* HelpDecoTitle(HELPDECO* hd, long topicoffset);
+extern HELPDECOAPI long HelpDecoLoadTitles(HELPDECO* hd);
+
+/* call proc for each keyword of keyword list (0 or 'K' for the K footnote
+// keywords, 'A' for ALink keywords, ...) starting with prefix (ignoring
+// case), or for each keyword from keywordnum (0 = first) on, with its
+// number (-1 if unknown), text and the topic offsets of its topics. Only
+// the pages of the keyword B+ tree holding these keywords are read.
+// Returns number of keywords seen */
+extern HELPDECOAPI long HelpDecoKeywords(HELPDECO* hd, int list, const char* prefix, HELPDECOKEYWORDPROC proc, void* ctx);
+extern HELPDECOAPI long HelpDecoKeywordsAt(HELPDECO* hd, int list, long keywordnum, HELPDECOKEYWORDPROC proc, void* ctx);
+
+/* call proc for each picture |bmN with N, its name and its data as stored
+// in the help file (SHG/MRB format, see HELPFILE.TXT) */
+extern HELPDECOAPI int HelpDecoBitmaps(HELPDECO* hd, HELPDECOBITMAPPROC proc, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif